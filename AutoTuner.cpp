@@ -0,0 +1,521 @@
+#include "AutoTuner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "FbdevFrameBuffer.h"
+#include "Ge2dConverter.h"
+#include "SoftwareConverter.h"
+#include "CopyKernels.h"
+#include "Timing.h"
+#include "Exception.h"
+
+
+// Mean absolute difference from the scalar reference, in 8 bit levels per
+// channel, that a backend may have. GE2D filters slightly differently.
+const double QUALITY_LIMIT = 4.0;
+
+
+static std::string Trim(const std::string& value)
+{
+	size_t start = value.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos)
+		return std::string();
+
+	size_t end = value.find_last_not_of(" \t\r\n");
+	return value.substr(start, end - start + 1);
+}
+
+static std::string ReadFirstLine(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (file == nullptr)
+		return std::string();
+
+	char line[256] = { 0 };
+	if (fgets(line, sizeof(line), file) == nullptr)
+		line[0] = 0;
+
+	fclose(file);
+
+	// The device tree model is NUL terminated without a newline
+	return Trim(line);
+}
+
+static std::string GetValue(const std::string& line, const char* name)
+{
+	std::string token = std::string(" ") + name + "=";
+
+	size_t start = line.find(token);
+	if (start == std::string::npos)
+		return std::string();
+
+	start += token.size();
+
+	size_t end = line.find(' ', start);
+	return line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+static double ChannelError(const PixelFormat& format, unsigned int a, unsigned int b)
+{
+	// Compared in 8 bit levels
+	a = format.Unpack(a);
+	b = format.Unpack(b);
+
+	int dr = (int)((a >> 16) & 0xff) - (int)((b >> 16) & 0xff);
+	int dg = (int)((a >> 8) & 0xff) - (int)((b >> 8) & 0xff);
+	int db = (int)(a & 0xff) - (int)(b & 0xff);
+
+	return (abs(dr) + abs(dg) + abs(db)) / 3.0;
+}
+
+
+AutoTuner::AutoTuner(FrameBuffer& source, FrameBuffer& sink, const MirrorOptions& options)
+	: source(source), sink(sink), profilePath(options.Profile), overlayPath(options.Overlay)
+{
+	transform = Mirror::ResolveTransform(sink, options);
+
+	sourceRect = options.SourceRect;
+	if (sourceRect.Width < 1 || sourceRect.Height < 1 ||
+		sourceRect.X + sourceRect.Width > source.Width() || sourceRect.Y + sourceRect.Height > source.Height())
+	{
+		sourceRect = { 0, 0, source.Width(), source.Height() };
+	}
+
+	// Same decision as the mirror; the threaded pipeline never writes the
+	// sink from GE2D
+	const char* reason;
+	if (options.ZeroCopy && !options.Threaded)
+		zeroCopyTarget = Mirror::FindZeroCopyTarget(sink, reason);
+
+
+	char sizes[64];
+	snprintf(sizes, sizeof(sizes), "%dx%dx%d:%dx%dx%d",
+		source.Width(), source.Height(), source.BitsPerPixel(),
+		sink.Width(), sink.Height(), sink.BitsPerPixel());
+
+	char conditions[96];
+	snprintf(conditions, sizeof(conditions), ":r%d%s%s:roi=%dx%d:%s:%s",
+		transform.Rotation, transform.FlipX ? "h" : "", transform.FlipY ? "v" : "",
+		sourceRect.Width, sourceRect.Height,
+		overlayPath.empty() ? "no-overlay" : "overlay",
+		zeroCopyTarget ? "zero-copy" : "copy");
+
+	key = BoardName() + ":" + sizes + conditions;
+}
+
+
+std::string AutoTuner::BoardName()
+{
+	std::string name = ReadFirstLine("/proc/device-tree/model");
+
+	if (name.empty())
+	{
+		FILE* file = fopen("/proc/cpuinfo", "r");
+		if (file != nullptr)
+		{
+			char line[256];
+			while (fgets(line, sizeof(line), file) != nullptr)
+			{
+				if (strncmp(line, "Hardware", 8) == 0)
+				{
+					const char* colon = strchr(line, ':');
+					if (colon)
+						name = Trim(colon + 1);
+					break;
+				}
+			}
+
+			fclose(file);
+		}
+	}
+
+	if (name.empty())
+		name = "unknown";
+
+	// Keys are a single token
+	for (char& c : name)
+	{
+		if (c == ' ' || c == '\t' || c == ':')
+			c = '_';
+	}
+
+	return name;
+}
+
+
+void AutoTuner::Apply(FrameBuffer& source, FrameBuffer& sink, MirrorOptions& options)
+{
+	if (options.Autotune == AutotuneMode::Off)
+		return;
+
+	AutoTuner tuner(source, sink, options);
+
+	if (options.Autotune == AutotuneMode::Force || !tuner.Load(options))
+	{
+		double start = GetTime();
+		tuner.Run(options);
+		printf("autotune: took %.2f s\n", GetTime() - start);
+
+		tuner.Save(options);
+	}
+}
+
+
+bool AutoTuner::Load(MirrorOptions& options) const
+{
+	FILE* file = fopen(profilePath.c_str(), "r");
+	if (file == nullptr)
+		return false;
+
+	std::string found;
+	char line[512];
+
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		std::string entry = Trim(line);
+		if (entry.compare(0, key.size() + 1, key + " ") == 0)
+			found = entry;
+	}
+
+	fclose(file);
+
+	if (found.empty())
+		return false;
+
+
+	std::string backend = GetValue(found, "backend");
+	std::string ionCache = GetValue(found, "ion-cache");
+	std::string copy = GetValue(found, "copy");
+
+	// The profile may come from an older kernel or build
+	try
+	{
+		if (backend == "ge2d")
+		{
+			if (!Ge2dConverter::IsAvailable() || !Mirror::IsGe2dTransformAllowed(transform, options))
+			{
+				return false;
+			}
+
+			Mirror::ParseIonCacheMode(ionCache);
+		}
+		else if (!SoftwareConverter::IsSupported(Mirror::ParseSimdLevel(backend)))
+		{
+			return false;
+		}
+
+		Mirror::ParseCopyMethod(copy);
+	}
+	catch (Exception&)
+	{
+		return false;
+	}
+
+	options.Backend = backend;
+	options.IonCache = ionCache;
+	options.Copy = copy;
+
+	printf("autotune: %s from %s: backend=%s ion-cache=%s copy=%s\n", key.c_str(), profilePath.c_str(),
+		backend.c_str(), ionCache.c_str(), copy.c_str());
+
+	return true;
+}
+
+void AutoTuner::Save(const MirrorOptions& options) const
+{
+	std::vector<std::string> lines;
+
+	FILE* file = fopen(profilePath.c_str(), "r");
+	if (file != nullptr)
+	{
+		char line[512];
+		while (fgets(line, sizeof(line), file) != nullptr)
+		{
+			std::string entry = Trim(line);
+			if (!entry.empty() && entry.compare(0, key.size() + 1, key + " ") != 0)
+				lines.push_back(entry);
+		}
+
+		fclose(file);
+	}
+
+	lines.push_back(key + " backend=" + options.Backend + " ion-cache=" + options.IonCache +
+		" copy=" + options.Copy);
+
+
+	// Create the directory of the profile; its parent is expected to exist
+	size_t slash = profilePath.rfind('/');
+	if (slash != std::string::npos && slash > 0)
+	{
+		std::string directory = profilePath.substr(0, slash);
+		if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+		{
+			fprintf(stderr, "autotune: can not create %s\n", directory.c_str());
+			return;
+		}
+	}
+
+	// Replace the file in one step so a crash never leaves half a profile
+	std::string temporary = profilePath + ".tmp";
+
+	file = fopen(temporary.c_str(), "w");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "autotune: can not write %s\n", temporary.c_str());
+		return;
+	}
+
+	for (const std::string& entry : lines)
+	{
+		fprintf(file, "%s\n", entry.c_str());
+	}
+
+	bool ok = fclose(file) == 0;
+
+	if (!ok || rename(temporary.c_str(), profilePath.c_str()) != 0)
+	{
+		fprintf(stderr, "autotune: can not write %s\n", profilePath.c_str());
+		remove(temporary.c_str());
+	}
+}
+
+
+double AutoTuner::Measure(Converter& converter, const unsigned char* reference, bool readback, double* error)
+{
+	const int WARMUP_FRAMES = 2;
+	const int FRAMES = 16;
+
+	size_t length = converter.OutputLength();
+	std::vector<unsigned char> output(length);
+
+	for (int i = 0; i < WARMUP_FRAMES; ++i)
+	{
+		converter.Convert(0);
+		converter.Wait();
+	}
+
+
+	// The page copy reads every converted frame back, so that is part of
+	// the cost of a backend, unless GE2D writes the sink itself.
+	double start = GetTime();
+	for (int i = 0; i < FRAMES; ++i)
+	{
+		converter.Convert(0);
+		converter.Wait();
+
+		if (readback)
+			memcpy(output.data(), converter.Output(0), length);
+	}
+	double elapsed = (GetTime() - start) / FRAMES;
+
+	if (!readback)
+		memcpy(output.data(), converter.Output(0), length);
+
+
+	const PixelFormat& format = sink.Format();
+	int bytes = format.BytesPerPixel();
+	size_t count = length / bytes;
+
+	double sum = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		sum += ChannelError(format, format.Load(output.data() + i * bytes), format.Load(reference + i * bytes));
+	}
+
+	*error = sum / count;
+
+	return elapsed;
+}
+
+void AutoTuner::Run(MirrorOptions& options)
+{
+	int logicalWidth = transform.SwapsAxes() ? sink.Height() : sink.Width();
+	int logicalHeight = transform.SwapsAxes() ? sink.Width() : sink.Height();
+
+	// Letterboxed by the mirrored region, like Mirror does
+	Rectangle dstRect = Mirror::CalculateDestination(sourceRect.Width, sourceRect.Height,
+		logicalWidth, logicalHeight, options.Aspect);
+
+	// Composited in every measurement
+	FrameBuffer* overlay = nullptr;
+	if (!overlayPath.empty())
+	{
+		overlay = FrameBuffer::Create(overlayPath.c_str(), 60);
+
+		if (overlay->Format() != PixelFormat::Xrgb8888())
+		{
+			delete overlay;
+			throw Exception("overlay must be 32 bpp ARGB");
+		}
+	}
+
+	auto prepareSoftware = [&](SoftwareConverter& converter)
+	{
+		converter.SetSource(source.Data(), source.Stride());
+
+		if (overlay)
+			converter.SetOverlay(overlay->Data(), overlay->Width(), overlay->Height(), overlay->Stride());
+
+		converter.SetSourceRect(sourceRect);
+	};
+
+	auto prepareGe2d = [&](Ge2dConverter& converter)
+	{
+		if (overlay)
+			converter.SetOverlay(*overlay);
+
+		converter.SetSourceRect(sourceRect);
+	};
+
+
+	// Everything is compared against the scalar conversion
+	SoftwareConverter referenceConverter(source.Width(), source.Height(), source.Format(),
+		sink.Width(), sink.Height(), sink.Format(), dstRect, SimdLevel::Scalar, 1, transform);
+	prepareSoftware(referenceConverter);
+	referenceConverter.Convert(0);
+
+	const unsigned char* referenceData = (const unsigned char*)referenceConverter.Output(0);
+	std::vector<unsigned char> reference(referenceData, referenceData + referenceConverter.OutputLength());
+
+
+	std::string bestBackend;
+	std::string bestIonCache = "default";
+	double bestTime = 0;
+
+	if (dynamic_cast<FbdevFrameBuffer*>(&source) != nullptr &&
+		(overlay == nullptr || dynamic_cast<FbdevFrameBuffer*>(overlay) != nullptr) &&
+		Mirror::IsGe2dTransformAllowed(transform, options) && Ge2dConverter::IsAvailable() &&
+		Ge2dConverter::IsSupported(source.Format()) && Ge2dConverter::IsSupported(sink.Format()))
+	{
+		if (zeroCopyTarget != 0)
+		{
+			// Writing the sink directly; the ION mapping is never read
+			try
+			{
+				Ge2dConverter converter(source, sink.Width(), sink.Height(), sink.Format(), dstRect,
+					zeroCopyTarget, sink.Data(), transform);
+				prepareGe2d(converter);
+
+				double error;
+				double elapsed = Measure(converter, reference.data(), false, &error);
+				bool usable = error <= QUALITY_LIMIT;
+
+				printf("autotune: ge2d/%-8s %8.3f ms error=%.2f%s\n", "zerocopy", elapsed * 1000.0, error,
+					usable ? "" : " (rejected)");
+
+				if (usable)
+				{
+					bestTime = elapsed;
+					bestBackend = "ge2d";
+				}
+			}
+			catch (Exception&)
+			{
+				printf("autotune: ge2d/%-8s failed\n", "zerocopy");
+			}
+		}
+		else
+		{
+			const IonCacheMode modes[] = { IonCacheMode::Cached, IonCacheMode::WriteCombine };
+
+			for (IonCacheMode mode : modes)
+			{
+				if (!IonBuffer::IsCacheModeSupported(mode))
+					continue;
+
+				const char* name = IonBuffer::CacheModeName(mode);
+
+				try
+				{
+					Ge2dConverter converter(source, sink.Width(), sink.Height(), sink.Format(), dstRect, 1, mode, transform);
+					prepareGe2d(converter);
+
+					double error;
+					double elapsed = Measure(converter, reference.data(), true, &error);
+					bool usable = error <= QUALITY_LIMIT;
+
+					printf("autotune: ge2d/%-8s %8.3f ms error=%.2f%s\n", name, elapsed * 1000.0, error,
+						usable ? "" : " (rejected)");
+
+					if (usable && (bestTime == 0 || elapsed < bestTime))
+					{
+						bestTime = elapsed;
+						bestBackend = "ge2d";
+						bestIonCache = name;
+					}
+				}
+				catch (Exception&)
+				{
+					printf("autotune: ge2d/%-8s failed\n", name);
+				}
+			}
+		}
+	}
+
+	const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon };
+
+	for (SimdLevel level : levels)
+	{
+		if (!SoftwareConverter::IsSupported(level))
+			continue;
+
+		SoftwareConverter converter(source.Width(), source.Height(), source.Format(),
+			sink.Width(), sink.Height(), sink.Format(), dstRect, level, 1, transform);
+		prepareSoftware(converter);
+
+		double error;
+		double elapsed = Measure(converter, reference.data(), true, &error);
+		bool usable = error <= QUALITY_LIMIT;
+
+		printf("autotune: %-13s %8.3f ms error=%.2f%s\n", converter.Name(), elapsed * 1000.0, error,
+			usable ? "" : " (rejected)");
+
+		if (usable && (bestTime == 0 || elapsed < bestTime))
+		{
+			bestTime = elapsed;
+			bestBackend = SoftwareConverter::SimdName(level);
+			bestIonCache = "default";
+		}
+	}
+
+	if (bestBackend.empty())
+	{
+		delete overlay;
+		throw Exception("autotune: no usable backend");
+	}
+
+
+	// The copy kernel is timed on the sink itself, from an output of the
+	// winner: its ION mapping, or the heap. Zero-copy needs no kernel.
+	const int COPY_ITERATIONS = 8;
+	CopyMethod copyMethod = CopyMethod::Memcpy;
+
+	if (bestBackend == "ge2d" && zeroCopyTarget == 0)
+	{
+		Ge2dConverter converter(source, sink.Width(), sink.Height(), sink.Format(), dstRect, 1,
+			Mirror::ParseIonCacheMode(bestIonCache), transform);
+		prepareGe2d(converter);
+		converter.Convert(0);
+		converter.Wait();
+
+		copyMethod = SelectCopyMethod(sink.Data(), converter.Output(0), converter.OutputLength(), COPY_ITERATIONS);
+	}
+	else if (bestBackend != "ge2d")
+	{
+		copyMethod = SelectCopyMethod(sink.Data(), reference.data(), reference.size(), COPY_ITERATIONS);
+	}
+
+	delete overlay;
+
+	options.Backend = bestBackend;
+	options.IonCache = bestIonCache;
+	options.Copy = CopyMethodName(copyMethod);
+
+	printf("autotune: %s: backend=%s ion-cache=%s copy=%s\n", key.c_str(),
+		options.Backend.c_str(), options.IonCache.c_str(), options.Copy.c_str());
+}
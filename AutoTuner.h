@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+
+#include "FrameBuffer.h"
+#include "Converter.h"
+#include "Mirror.h"
+
+
+// Picks the conversion backend, ION cache mode and copy kernel that are
+// fastest on this board for the given source and sink, and remembers the
+// choice in a profile file. The key is the board, the resolutions and
+// everything else that changes the winner: rotation and flips, the size
+// of the mirrored region, the overlay and whether GE2D could write the
+// sink directly.
+class AutoTuner
+{
+	FrameBuffer& source;
+	FrameBuffer& sink;
+	std::string profilePath;
+
+	// What the mirror will run with, measured the same way
+	Transform transform;
+	Rectangle sourceRect;
+	std::string overlayPath;
+	unsigned long zeroCopyTarget = 0;
+
+	std::string key;
+
+
+	double Measure(Converter& converter, const unsigned char* reference, bool readback, double* error);
+
+
+public:
+
+	const std::string& Key() const
+	{
+		return key;
+	}
+
+
+	AutoTuner(FrameBuffer& source, FrameBuffer& sink, const MirrorOptions& options);
+
+
+	// Model of the board from the device tree, or the cpuinfo hardware line
+	static std::string BoardName();
+
+	// Tunes options as options.Autotune asks: loads the saved profile, or
+	// measures and saves one when there is none or a retune is forced.
+	static void Apply(FrameBuffer& source, FrameBuffer& sink, MirrorOptions& options);
+
+
+	// Applies a saved profile. Returns false when there is none for Key().
+	bool Load(MirrorOptions& options) const;
+
+	// Adds or replaces the profile for Key()
+	void Save(const MirrorOptions& options) const;
+
+	// Times every candidate and applies the fastest to options
+	void Run(MirrorOptions& options);
+};
@@ -0,0 +1,69 @@
+#include "Backlight.h"
+
+#include <stdio.h>
+
+
+static int ReadDuty(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (file == nullptr)
+		return -1;
+
+	int value = -1;
+	if (fscanf(file, "%d", &value) != 1)
+		value = -1;
+
+	fclose(file);
+
+	return value;
+}
+
+static bool WriteDuty(const char* path, int value)
+{
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+		return false;
+
+	bool ok = fprintf(file, "%d\n", value) > 0;
+	ok = (fclose(file) == 0) && ok;
+
+	return ok;
+}
+
+
+Backlight::Backlight(const char* path)
+	: path(path)
+{
+}
+
+Backlight::~Backlight()
+{
+	Restore();
+}
+
+
+bool Backlight::Dim(int duty)
+{
+	if (dimmed)
+		return true;
+
+	brightness = ReadDuty(path.c_str());
+	if (brightness < 0)
+		return false;
+
+	if (!WriteDuty(path.c_str(), duty))
+		return false;
+
+	dimmed = true;
+
+	return true;
+}
+
+void Backlight::Restore()
+{
+	if (!dimmed)
+		return;
+
+	WriteDuty(path.c_str(), brightness);
+	dimmed = false;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+
+// LCD backlight driven through the pwm-ctrl duty sysfs attribute that
+// initlcd.sh configures.
+class Backlight
+{
+	std::string path;
+	int brightness = -1;
+	bool dimmed = false;
+
+
+public:
+
+	bool IsDimmed() const
+	{
+		return dimmed;
+	}
+
+
+	Backlight(const char* path = "/sys/devices/platform/pwm-ctrl/duty0");
+	~Backlight();
+
+
+	// Returns false when the duty can not be written
+	bool Dim(int duty);
+	void Restore();
+};
@@ -0,0 +1,529 @@
+#include "Benchmark.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+
+#include "FrameBuffer.h"
+#include "FbdevFrameBuffer.h"
+#include "Mirror.h"
+#include "MirrorGroup.h"
+#include "AutoTuner.h"
+#include "LatencyProbe.h"
+#include "IonBuffer.h"
+#include "CopyKernels.h"
+#include "Exception.h"
+#include "Timing.h"
+
+
+// Static gradient with a box moving across it, so that the dirty page
+// copy sees a realistic mix of changed and unchanged pages.
+static void DrawTestPattern(FrameBuffer& fb, int frame)
+{
+	const int BOX_SIZE = 128;
+
+	int boxX = (frame * 8) % (fb.Width() - BOX_SIZE);
+	int boxY = fb.Height() / 2 - BOX_SIZE / 2;
+
+	for (int y = 0; y < fb.Height(); ++y)
+	{
+		unsigned char* row = (unsigned char*)fb.Data() + (size_t)y * fb.Stride();
+
+		bool boxRow = (y >= boxY && y < boxY + BOX_SIZE);
+
+		// Only the rows that the box touches (plus the first frame) change
+		if (frame > 0 && !boxRow && !(y >= boxY - 8 && y < boxY + BOX_SIZE + 8))
+			continue;
+
+		for (int x = 0; x < fb.Width(); ++x)
+		{
+			unsigned int color;
+			if (boxRow && x >= boxX && x < boxX + BOX_SIZE)
+			{
+				color = 0xffff0000;
+			}
+			else
+			{
+				color = 0xff000000 | ((x * 255 / fb.Width()) << 8) | (y * 255 / fb.Height());
+			}
+
+			const PixelFormat& format = fb.Format();
+			format.Store(row + x * format.BytesPerPixel(), format.Pack(color));
+		}
+	}
+}
+
+
+static void PrintStage(const char* name, const Statistics& stats)
+{
+	printf("%-8s min=%8.3f median=%8.3f p99=%8.3f max=%8.3f ms\n", name,
+		stats.Min() * 1000.0, stats.Percentile(0.5) * 1000.0,
+		stats.Percentile(0.99) * 1000.0, stats.Max() * 1000.0);
+}
+
+static void PrintStageJson(const char* name, const Statistics& stats, bool last)
+{
+	printf("\"%s\":{\"min\":%.4f,\"median\":%.4f,\"p99\":%.4f,\"max\":%.4f}%s", name,
+		stats.Min() * 1000.0, stats.Percentile(0.5) * 1000.0,
+		stats.Percentile(0.99) * 1000.0, stats.Max() * 1000.0,
+		last ? "" : ",");
+}
+
+
+static void PrintReport(const Mirror& mirror, int frames, double elapsed)
+{
+	const FrameBuffer& source = mirror.Source();
+	const FrameBuffer& sink = mirror.Sink();
+
+	const DirtyCopy& copy = mirror.Copy();
+	double fps = frames / elapsed;
+	double presentedFps = mirror.Presented() / elapsed;
+	double sinkBytesPerSecond = copy.BytesWritten() / elapsed;
+	double convertedBytesPerSecond = (double)mirror.GetConverter().OutputLength() * mirror.Produced() / elapsed;
+
+
+	printf("frames=%d elapsed=%.3f s fps=%.1f presented fps=%.1f\n", frames, elapsed, fps, presentedFps);
+	printf("produced=%llu presented=%llu skipped=%llu idle=%llu dropped=%llu\n",
+		mirror.Produced(), mirror.Presented(), mirror.Skipped(), mirror.IdleFrames(), mirror.Dropped());
+	unsigned long long copied = copy.BytesWritten() + copy.BytesSkipped();
+
+	printf("sink: %.1f MB/s written, %.1f MB/s converted, %.1f%% skipped%s\n",
+		sinkBytesPerSecond / 1e6, convertedBytesPerSecond / 1e6,
+		copied ? 100.0 * copy.BytesSkipped() / copied : 0.0,
+		mirror.IsZeroCopy() ? " (zero-copy)" : "");
+
+	PrintStage("vsync", mirror.VSyncTime());
+	PrintStage("wait", mirror.WaitTime());
+	PrintStage("convert", mirror.ConvertTime());
+	PrintStage("copy", mirror.CopyTime());
+	PrintStage("frame", mirror.FrameTime());
+	PrintStage("latency", mirror.Latency());
+
+
+	// Machine readable summary
+	printf("{\"frames\":%d,\"backend\":\"%s\",\"depth\":%d,"
+		"\"source\":\"%dx%dx%d\",\"sink\":\"%dx%dx%d\",\"sink_name\":\"%s\","
+		"\"fps\":%.2f,\"presented_fps\":%.2f,\"sink_bytes_per_s\":%.0f,\"converted_bytes_per_s\":%.0f,"
+		"\"bytes_written\":%llu,\"bytes_skipped\":%llu,"
+		"\"produced\":%llu,\"presented\":%llu,\"skipped\":%llu,\"idle\":%llu,\"dropped\":%llu,"
+		"\"threaded\":%s,\"stages_ms\":{",
+		frames, mirror.GetConverter().Name(), mirror.GetConverter().BufferCount(),
+		source.Width(), source.Height(), source.BitsPerPixel(),
+		sink.Width(), sink.Height(), sink.BitsPerPixel(), sink.DeviceName().c_str(),
+		fps, presentedFps, sinkBytesPerSecond, convertedBytesPerSecond,
+		copy.BytesWritten(), copy.BytesSkipped(),
+		mirror.Produced(), mirror.Presented(), mirror.Skipped(), mirror.IdleFrames(), mirror.Dropped(),
+		mirror.IsThreaded() ? "true" : "false");
+
+	PrintStageJson("vsync", mirror.VSyncTime(), false);
+	PrintStageJson("wait", mirror.WaitTime(), false);
+	PrintStageJson("convert", mirror.ConvertTime(), false);
+	PrintStageJson("copy", mirror.CopyTime(), false);
+	PrintStageJson("frame", mirror.FrameTime(), false);
+	PrintStageJson("latency", mirror.Latency(), true);
+
+	printf("}}\n");
+}
+
+
+// Opens the sinks and mirrors source onto them, keeping frames samples
+static MirrorGroup* CreateGroup(FrameBuffer& source, const std::vector<SinkConfig>& sinks, double rate,
+	int frames, std::vector<FrameBuffer*>& outputs)
+{
+	MirrorGroup* group = new MirrorGroup(source);
+
+	for (const SinkConfig& config : sinks)
+	{
+		FrameBuffer* sink = FrameBuffer::Create(config.Spec.c_str(), rate);
+		outputs.push_back(sink);
+
+		MirrorOptions options = config.Options;
+		options.StatsWindow = frames;
+
+		AutoTuner::Apply(source, *sink, options);
+
+		group->Add(new Mirror(source, *sink, options));
+	}
+
+	return group;
+}
+
+
+void RunBenchmark(int frames, const char* input, const std::vector<SinkConfig>& sinks, double rate)
+{
+	if (frames < 1)
+	{
+		frames = 1;
+	}
+
+
+	FrameBuffer* source = FrameBuffer::Create(input, rate);
+
+	// Never draw over a real display
+	bool synthetic = dynamic_cast<FbdevFrameBuffer*>(source) == nullptr;
+
+	std::vector<FrameBuffer*> outputs;
+	MirrorGroup* group = CreateGroup(*source, sinks, rate, frames, outputs);
+
+
+	double start = GetTime();
+	double busy = 0;
+
+	for (int i = 0; i < frames; ++i)
+	{
+		if (synthetic)
+		{
+			double drawStart = GetTime();
+			DrawTestPattern(*source, i);
+			busy += GetTime() - drawStart;
+		}
+
+		group->RunFrame();
+	}
+
+	group->Stop();
+
+	double elapsed = GetTime() - start - busy;
+
+	for (const Mirror* mirror : group->Mirrors())
+	{
+		if (sinks.size() > 1)
+			printf("[%s]\n", mirror->Sink().DeviceName().c_str());
+
+		PrintReport(*mirror, frames, elapsed);
+	}
+
+
+	delete group;
+
+	for (FrameBuffer* sink : outputs)
+	{
+		delete sink;
+	}
+
+	delete source;
+}
+
+
+static void PrintProbe(const char* name, const Statistics& stats)
+{
+	if (stats.Count() == 0)
+	{
+		printf("%-8s no marker seen\n", name);
+		return;
+	}
+
+	printf("%-8s seen=%-6zu min=%8.3f median=%8.3f p99=%8.3f max=%8.3f ms\n", name, stats.Count(),
+		stats.Min() * 1000.0, stats.Percentile(0.5) * 1000.0,
+		stats.Percentile(0.99) * 1000.0, stats.Max() * 1000.0);
+}
+
+static void PrintProbeJson(const char* name, const Statistics& stats, bool last)
+{
+	if (stats.Count() == 0)
+	{
+		printf("\"%s\":{\"seen\":0}%s", name, last ? "" : ",");
+		return;
+	}
+
+	printf("\"%s\":{\"seen\":%zu,\"min\":%.4f,\"median\":%.4f,\"p99\":%.4f,\"max\":%.4f}%s", name,
+		stats.Count(), stats.Min() * 1000.0, stats.Percentile(0.5) * 1000.0,
+		stats.Percentile(0.99) * 1000.0, stats.Max() * 1000.0,
+		last ? "" : ",");
+}
+
+void RunLatencyProbe(int frames, const char* input, const std::vector<SinkConfig>& sinks, double rate)
+{
+	if (frames < 1)
+	{
+		frames = 1;
+	}
+
+
+	FrameBuffer* source = FrameBuffer::Create(input, rate);
+
+	if (dynamic_cast<FbdevFrameBuffer*>(source) != nullptr)
+	{
+		printf("probe: drawing markers into %s\n", source->DeviceName().c_str());
+	}
+
+	std::vector<FrameBuffer*> outputs;
+	MirrorGroup* group = CreateGroup(*source, sinks, rate, frames, outputs);
+
+	std::vector<LatencyProbe*> probes;
+	for (const Mirror* mirror : group->Mirrors())
+	{
+		probes.push_back(new LatencyProbe(*source, *mirror, frames));
+	}
+
+
+	for (int i = 0; i < frames; ++i)
+	{
+		double now = GetTime();
+		for (LatencyProbe* probe : probes)
+		{
+			probe->Inject(now);
+		}
+
+		group->RunFrame();
+
+		now = GetTime();
+		for (LatencyProbe* probe : probes)
+		{
+			probe->Sample(now);
+		}
+	}
+
+	group->Stop();
+
+
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		const Mirror* mirror = group->Mirrors()[i];
+		const LatencyProbe* probe = probes[i];
+
+		if (sinks.size() > 1)
+			printf("[%s]\n", mirror->Sink().DeviceName().c_str());
+
+		printf("markers=%llu presented=%llu skipped=%llu dropped=%llu\n", probe->Injected(),
+			mirror->Presented(), mirror->Skipped(), mirror->Dropped());
+
+		PrintProbe("output", probe->OutputLatency());
+		PrintProbe("sink", probe->SinkLatency());
+
+		printf("{\"sink_name\":\"%s\",\"backend\":\"%s\",\"threaded\":%s,\"markers\":%llu,\"latency_ms\":{",
+			mirror->Sink().DeviceName().c_str(), mirror->GetConverter().Name(),
+			mirror->IsThreaded() ? "true" : "false", probe->Injected());
+
+		PrintProbeJson("output", probe->OutputLatency(), false);
+		PrintProbeJson("sink", probe->SinkLatency(), true);
+
+		printf("}}\n");
+	}
+
+
+	for (LatencyProbe* probe : probes)
+	{
+		delete probe;
+	}
+
+	delete group;
+
+	for (FrameBuffer* sink : outputs)
+	{
+		delete sink;
+	}
+
+	delete source;
+}
+
+
+void RunConvertBenchmark(int frames)
+{
+	const int SRC_WIDTH = 1920;
+	const int SRC_HEIGHT = 1080;
+	const int DST_WIDTH = 480;
+	const int DST_HEIGHT = 320;
+
+	std::vector<unsigned int> source(SRC_WIDTH * SRC_HEIGHT);
+	for (size_t i = 0; i < source.size(); ++i)
+	{
+		source[i] = (unsigned int)(i * 2654435761u);
+	}
+
+	Rectangle dstRect = Mirror::CalculateDestination(SRC_WIDTH, SRC_HEIGHT, DST_WIDTH, DST_HEIGHT, -1);
+
+	SoftwareConverter reference(SRC_WIDTH, SRC_HEIGHT, PixelFormat::Xrgb8888(),
+		DST_WIDTH, DST_HEIGHT, PixelFormat::Rgb565(), dstRect, SimdLevel::Scalar);
+	reference.SetSource(source.data());
+	reference.Convert(0);
+
+	const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon };
+	double scalarTime = 0;
+
+	for (SimdLevel level : levels)
+	{
+		if (!SoftwareConverter::IsSupported(level))
+			continue;
+
+		SoftwareConverter converter(SRC_WIDTH, SRC_HEIGHT, PixelFormat::Xrgb8888(),
+			DST_WIDTH, DST_HEIGHT, PixelFormat::Rgb565(), dstRect, level);
+		converter.SetSource(source.data());
+
+		double start = GetTime();
+		for (int i = 0; i < frames; ++i)
+		{
+			converter.Convert(0);
+		}
+		double elapsed = (GetTime() - start) / frames;
+
+		if (level == SimdLevel::Scalar)
+			scalarTime = elapsed;
+
+		bool match = memcmp(converter.Output(0), reference.Output(0), reference.OutputLength()) == 0;
+
+		printf("%s: %.3f ms/frame, %.1f fps, %.2fx scalar, output %s\n",
+			converter.Name(), elapsed * 1000.0, 1.0 / elapsed,
+			scalarTime / elapsed,
+			match ? "matches" : "DIFFERS");
+	}
+}
+
+
+static double TimeReadback(void* buffer, IonBuffer* ion, size_t length, int iterations)
+{
+	std::vector<unsigned char> copy(length);
+
+	double start = GetTime();
+	for (int i = 0; i < iterations; ++i)
+	{
+		// What a conversion leaves behind in cached mode
+		if (ion)
+			ion->InvalidateRange(buffer, length);
+
+		memcpy(copy.data(), buffer, length);
+	}
+
+	return (GetTime() - start) / iterations;
+}
+
+void RunReadbackBenchmark(int iterations)
+{
+	// One 480x320 RGB565 frame
+	const size_t LENGTH = 480 * 320 * 2;
+
+	if (iterations < 1)
+	{
+		iterations = 1;
+	}
+
+
+	std::vector<unsigned char> reference(LENGTH, 0x5a);
+	double elapsed = TimeReadback(reference.data(), nullptr, LENGTH, iterations);
+
+	printf("%-9s %8.3f ms/frame %8.1f MB/s\n", "heap", elapsed * 1000.0, LENGTH / elapsed / 1e6);
+
+
+	if (access("/dev/ion", R_OK | W_OK) != 0)
+	{
+		printf("ion: /dev/ion not available\n");
+		return;
+	}
+
+	const IonCacheMode modes[] = { IonCacheMode::Cached, IonCacheMode::WriteCombine, IonCacheMode::Uncached };
+
+	for (IonCacheMode mode : modes)
+	{
+		if (!IonBuffer::IsCacheModeSupported(mode))
+		{
+			printf("%-9s not supported on this CPU\n", IonBuffer::CacheModeName(mode));
+			continue;
+		}
+
+		try
+		{
+			IonBuffer buffer(LENGTH, mode);
+			void* data = buffer.Map();
+
+			memset(data, 0x5a, LENGTH);
+			buffer.Sync();
+
+			elapsed = TimeReadback(data, &buffer, LENGTH, iterations);
+
+			printf("%-9s %8.3f ms/frame %8.1f MB/s\n", IonBuffer::CacheModeName(buffer.CacheMode()),
+				elapsed * 1000.0, LENGTH / elapsed / 1e6);
+
+			munmap(data, buffer.Length());
+		}
+		catch (Exception&)
+		{
+			// The reason has been printed to stderr
+			printf("%-9s failed\n", IonBuffer::CacheModeName(mode));
+		}
+	}
+}
+
+
+static void TimeCopyKernels(const char* name, void* destination, const void* source, size_t length, int iterations)
+{
+	const CopyMethod methods[] = { CopyMethod::Memcpy, CopyMethod::Neon, CopyMethod::Stream };
+
+	for (CopyMethod method : methods)
+	{
+		if (!IsCopySupported(method))
+			continue;
+
+		CopyFunction copy = GetCopyFunction(method);
+		copy(destination, source, length);
+
+		double start = GetTime();
+		for (int i = 0; i < iterations; ++i)
+		{
+			copy(destination, source, length);
+		}
+		double elapsed = (GetTime() - start) / iterations;
+
+		printf("%-16s %-7s %8.3f ms %8.1f MB/s\n", name, CopyMethodName(method),
+			elapsed * 1000.0, length / elapsed / 1e6);
+	}
+}
+
+void RunCopyBenchmark(int iterations, const char* output)
+{
+	// One 480x320 RGB565 frame, and a block well beyond the caches
+	const size_t FRAME_LENGTH = 480 * 320 * 2;
+	const size_t LARGE_LENGTH = 32 * 1024 * 1024;
+
+	if (iterations < 1)
+	{
+		iterations = 1;
+	}
+
+
+	std::vector<unsigned char> source(LARGE_LENGTH, 0x5a);
+	std::vector<unsigned char> destination(LARGE_LENGTH);
+
+	TimeCopyKernels("heap frame", destination.data(), source.data(), FRAME_LENGTH, iterations);
+	TimeCopyKernels("heap 32M", destination.data(), source.data(), LARGE_LENGTH, (iterations + 15) / 16);
+
+
+	IonBuffer* ion = nullptr;
+	void* ionData = nullptr;
+
+	if (access("/dev/ion", R_OK | W_OK) == 0)
+	{
+		ion = new IonBuffer(FRAME_LENGTH);
+		ionData = ion->Map();
+
+		memset(ionData, 0x5a, FRAME_LENGTH);
+		ion->Sync();
+
+		TimeCopyKernels("ion -> heap", destination.data(), ionData, FRAME_LENGTH, iterations);
+	}
+
+
+	if (output)
+	{
+		FrameBuffer* sink = FrameBuffer::Create(output, 0);
+
+		size_t length = sink->Length();
+		if (length > FRAME_LENGTH)
+			length = FRAME_LENGTH;
+
+		TimeCopyKernels("heap -> sink", sink->Data(), source.data(), length, iterations);
+
+		if (ionData)
+			TimeCopyKernels("ion -> sink", sink->Data(), ionData, length, iterations);
+
+		delete sink;
+	}
+
+
+	if (ion)
+	{
+		munmap(ionData, ion->Length());
+		delete ion;
+	}
+}
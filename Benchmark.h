@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include "Mirror.h"
+#include "MirrorGroup.h"
+
+
+// Runs the mirror loop for a fixed number of frames and prints the
+// per-stage latency distribution of each sink, followed by a single line
+// of JSON per sink.
+void RunBenchmark(int frames, const char* input, const std::vector<SinkConfig>& sinks, double rate);
+
+// Mirrors frames while drawing time-coded markers into the source, and
+// prints how old the markers are when they reach the converted buffers
+// and the sink
+void RunLatencyProbe(int frames, const char* input, const std::vector<SinkConfig>& sinks, double rate);
+
+// Times the CPU converters against the scalar reference
+void RunConvertBenchmark(int frames);
+
+// Times CPU reads of a converted frame from ION memory in each cache mode
+void RunReadbackBenchmark(int iterations);
+
+// Times each copy kernel against memcpy on ordinary memory, from ION
+// memory when available, and into the framebuffer given by output
+void RunCopyBenchmark(int iterations, const char* output);
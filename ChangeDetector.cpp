@@ -0,0 +1,128 @@
+#include "ChangeDetector.h"
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Exception.h"
+
+
+// Fletcher style sums over 32 bit lanes: the second sum makes the result
+// depend on where in the row a word changed, not just on its value.
+static unsigned long long HashRow(const unsigned char* row, int count, unsigned long long seed)
+{
+	int i = 0;
+	unsigned int sum1 = 0;
+	unsigned int sum2 = 0;
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+	uint32x4_t a = vdupq_n_u32(0);
+	uint32x4_t b = vdupq_n_u32(0);
+
+	for (; i + 32 <= count; i += 32)
+	{
+		a = vaddq_u32(a, vld1q_u32((const uint32_t*)(row + i)));
+		b = vaddq_u32(b, a);
+		a = vaddq_u32(a, vld1q_u32((const uint32_t*)(row + i + 16)));
+		b = vaddq_u32(b, a);
+	}
+
+	uint32_t lanes[8];
+	vst1q_u32(lanes, a);
+	vst1q_u32(lanes + 4, b);
+
+	for (int j = 0; j < 4; ++j)
+	{
+		sum1 += lanes[j] * (j + 1);
+		sum2 += lanes[4 + j] * (j + 1);
+	}
+#elif defined(__SSE2__)
+	__m128i a = _mm_setzero_si128();
+	__m128i b = _mm_setzero_si128();
+
+	for (; i + 32 <= count; i += 32)
+	{
+		a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i*)(row + i)));
+		b = _mm_add_epi32(b, a);
+		a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i*)(row + i + 16)));
+		b = _mm_add_epi32(b, a);
+	}
+
+	unsigned int lanes[8];
+	_mm_storeu_si128((__m128i*)lanes, a);
+	_mm_storeu_si128((__m128i*)(lanes + 4), b);
+
+	for (int j = 0; j < 4; ++j)
+	{
+		sum1 += lanes[j] * (j + 1);
+		sum2 += lanes[4 + j] * (j + 1);
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		sum1 += row[i];
+		sum2 += sum1;
+	}
+
+
+	unsigned long long hash = seed ^ (((unsigned long long)sum2 << 32) | sum1);
+	return hash * 0x9e3779b97f4a7c15ull;
+}
+
+
+ChangeDetector::ChangeDetector(int rowBytes, int height, int stride)
+	: rowBytes(rowBytes), height(height), stride(stride)
+{
+	if (rowBytes < 1 || height < 1)
+		throw Exception("invalid frame size");
+
+	if (stride < rowBytes)
+		throw Exception("stride < rowBytes");
+
+	hashes.resize((height + BAND_ROWS - 1) / BAND_ROWS);
+}
+
+
+unsigned long long ChangeDetector::HashBand(const void* data, int band) const
+{
+	unsigned long long hash = 0;
+
+	int end = (band + 1) * BAND_ROWS;
+	if (end > height)
+		end = height;
+
+	for (int y = band * BAND_ROWS; y < end; ++y)
+	{
+		hash = HashRow((const unsigned char*)data + (size_t)y * stride, rowBytes, hash);
+	}
+
+	return hash;
+}
+
+
+void ChangeDetector::Reset(const void* data)
+{
+	for (size_t i = 0; i < hashes.size(); ++i)
+	{
+		hashes[i] = HashBand(data, i);
+	}
+}
+
+bool ChangeDetector::HasChanged(const void* data)
+{
+	for (size_t i = 0; i < hashes.size(); ++i)
+	{
+		unsigned long long hash = HashBand(data, i);
+
+		if (hash != hashes[i])
+		{
+			hashes[i] = hash;
+			return true;
+		}
+	}
+
+	return false;
+}
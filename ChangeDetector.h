@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+
+// Detection of changes to a mapped framebuffer. Every check hashes the
+// whole frame band by band and stops at the first band that differs, so
+// a change anywhere is seen on the first check after it and the check
+// that sees it is the cheapest.
+class ChangeDetector
+{
+	int rowBytes;
+	int height;
+	int stride;
+	std::vector<unsigned long long> hashes;
+
+
+	unsigned long long HashBand(const void* data, int band) const;
+
+
+public:
+
+	// Rows hashed together
+	static const int BAND_ROWS = 16;
+
+
+	// Only the rowBytes visible bytes of each row are read; stride is the
+	// step from one row to the next
+	ChangeDetector(int rowBytes, int height, int stride);
+
+
+	// Hashes every row of data as the unchanged reference
+	void Reset(const void* data);
+
+	// Returns true if any row differs from the reference. The bands after
+	// the first changed one keep their old hash and are reported again on
+	// the next check.
+	bool HasChanged(const void* data);
+};
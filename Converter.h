@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+
+
+struct Rectangle
+{
+	int X;
+	int Y;
+	int Width;
+	int Height;
+};
+
+
+// Clockwise rotation and mirroring from the logical (upright) LCD image to
+// the output buffer. The flips are applied to the logical image.
+struct Transform
+{
+	int Rotation = 0;
+	bool FlipX = false;
+	bool FlipY = false;
+
+
+	bool SwapsAxes() const
+	{
+		return Rotation == 90 || Rotation == 270;
+	}
+
+	bool IsIdentity() const
+	{
+		return Rotation == 0 && !FlipX && !FlipY;
+	}
+
+	// Where a rectangle of the logical image ends up in an output buffer
+	// of width x height.
+	Rectangle Map(const Rectangle& rect, int width, int height) const
+	{
+		int logicalWidth = SwapsAxes() ? height : width;
+		int logicalHeight = SwapsAxes() ? width : height;
+
+		Rectangle flipped = rect;
+		if (FlipX)
+			flipped.X = logicalWidth - (rect.X + rect.Width);
+		if (FlipY)
+			flipped.Y = logicalHeight - (rect.Y + rect.Height);
+
+		Rectangle result;
+
+		switch (Rotation)
+		{
+			case 90:
+				result.X = width - (flipped.Y + flipped.Height);
+				result.Y = flipped.X;
+				result.Width = flipped.Height;
+				result.Height = flipped.Width;
+				break;
+
+			case 180:
+				result.X = width - (flipped.X + flipped.Width);
+				result.Y = height - (flipped.Y + flipped.Height);
+				result.Width = flipped.Width;
+				result.Height = flipped.Height;
+				break;
+
+			case 270:
+				result.X = flipped.Y;
+				result.Y = height - (flipped.X + flipped.Width);
+				result.Width = flipped.Height;
+				result.Height = flipped.Width;
+				break;
+
+			default:
+				result = flipped;
+				break;
+		}
+
+		return result;
+	}
+};
+
+
+// Scales the source framebuffer into the destination rectangle of one of
+// BufferCount() output buffers, which are in the pixel format of the sink
+// (RGB565, RGB666, ...).
+class Converter
+{
+public:
+
+	virtual ~Converter()
+	{
+	}
+
+
+	virtual const char* Name() const = 0;
+
+	virtual int BufferCount() const = 0;
+	virtual void* Output(int index) const = 0;
+	virtual size_t OutputLength() const = 0;
+
+
+	// Selects the part of the source scaled into the destination; the
+	// whole source until called. Takes effect with the next Convert.
+	virtual void SetSourceRect(const Rectangle& rect) = 0;
+
+	// Position of the displayed page of a panned source (fb_var_screeninfo
+	// xoffset/yoffset). Takes effect with the next Convert.
+	virtual void SetSourceOffset(int x, int y) = 0;
+
+
+	// Starts converting into buffer index. The conversion may still be
+	// running when this returns.
+	virtual void Convert(int index) = 0;
+
+	// Blocks until every conversion started so far has completed.
+	virtual void Wait() = 0;
+
+	// Device calls that failed without stopping the conversion
+	virtual unsigned long long Errors() const
+	{
+		return 0;
+	}
+};
@@ -0,0 +1,197 @@
+#include "CopyKernels.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// STNP only exists on aarch64; 32 bit NEON has no non-temporal store
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#include "Timing.h"
+
+
+// Stores are issued in groups of this many bytes
+const size_t GROUP_SIZE = 64;
+
+
+static void CopyMemcpy(void* destination, const void* source, size_t count)
+{
+	memcpy(destination, source, count);
+}
+
+
+#if defined(HAVE_NEON)
+static void CopyNeon(void* destination, const void* source, size_t count)
+{
+	unsigned char* dst = (unsigned char*)destination;
+	const unsigned char* src = (const unsigned char*)source;
+
+	// Write-combined framebuffer memory only bursts full aligned lines
+	size_t head = (GROUP_SIZE - ((uintptr_t)dst & (GROUP_SIZE - 1))) & (GROUP_SIZE - 1);
+	if (head > count)
+		head = count;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	count -= head;
+
+	for (; count >= GROUP_SIZE; count -= GROUP_SIZE)
+	{
+		uint8x16_t v0 = vld1q_u8(src);
+		uint8x16_t v1 = vld1q_u8(src + 16);
+		uint8x16_t v2 = vld1q_u8(src + 32);
+		uint8x16_t v3 = vld1q_u8(src + 48);
+
+		// Non-temporal pairs; the LCD is not read back, so the lines
+		// need not be allocated
+		asm volatile("stnp %q0, %q1, [%2]" : : "w"(v0), "w"(v1), "r"(dst) : "memory");
+		asm volatile("stnp %q0, %q1, [%2, #32]" : : "w"(v2), "w"(v3), "r"(dst) : "memory");
+
+		src += GROUP_SIZE;
+		dst += GROUP_SIZE;
+	}
+
+	memcpy(dst, src, count);
+}
+#endif
+
+
+#if defined(HAVE_SSE2)
+static void CopyStream(void* destination, const void* source, size_t count)
+{
+	unsigned char* dst = (unsigned char*)destination;
+	const unsigned char* src = (const unsigned char*)source;
+
+	// Non-temporal stores need a 16 byte aligned destination
+	size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+	if (head > count)
+		head = count;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	count -= head;
+
+	for (; count >= GROUP_SIZE; count -= GROUP_SIZE)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i*)src);
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(src + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i*)(src + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i*)(src + 48));
+
+		_mm_stream_si128((__m128i*)dst, v0);
+		_mm_stream_si128((__m128i*)(dst + 16), v1);
+		_mm_stream_si128((__m128i*)(dst + 32), v2);
+		_mm_stream_si128((__m128i*)(dst + 48), v3);
+
+		src += GROUP_SIZE;
+		dst += GROUP_SIZE;
+	}
+
+	// Order the streaming stores before anything that follows
+	_mm_sfence();
+
+	memcpy(dst, src, count);
+}
+#endif
+
+
+bool IsCopySupported(CopyMethod method)
+{
+	switch (method)
+	{
+		case CopyMethod::Memcpy:
+			return true;
+
+#if defined(HAVE_NEON)
+		case CopyMethod::Neon:
+			return true;
+#endif
+
+#if defined(HAVE_SSE2)
+		case CopyMethod::Stream:
+			return true;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+const char* CopyMethodName(CopyMethod method)
+{
+	switch (method)
+	{
+		case CopyMethod::Neon:
+			return "neon";
+
+		case CopyMethod::Stream:
+			return "stream";
+
+		default:
+			return "memcpy";
+	}
+}
+
+CopyFunction GetCopyFunction(CopyMethod method)
+{
+	switch (method)
+	{
+#if defined(HAVE_NEON)
+		case CopyMethod::Neon:
+			return CopyNeon;
+#endif
+
+#if defined(HAVE_SSE2)
+		case CopyMethod::Stream:
+			return CopyStream;
+#endif
+
+		default:
+			return CopyMemcpy;
+	}
+}
+
+
+CopyMethod SelectCopyMethod(void* destination, const void* source, size_t count, int iterations)
+{
+	const CopyMethod methods[] = { CopyMethod::Memcpy, CopyMethod::Neon, CopyMethod::Stream };
+
+	CopyMethod result = CopyMethod::Memcpy;
+	double best = 0;
+
+	for (CopyMethod method : methods)
+	{
+		if (!IsCopySupported(method))
+			continue;
+
+		CopyFunction copy = GetCopyFunction(method);
+
+		// The first pass only warms up the mappings
+		copy(destination, source, count);
+
+		double start = GetTime();
+		for (int i = 0; i < iterations; ++i)
+		{
+			copy(destination, source, count);
+		}
+		double elapsed = GetTime() - start;
+
+		if (best == 0 || elapsed < best)
+		{
+			best = elapsed;
+			result = method;
+		}
+	}
+
+	return result;
+}
+
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+
+enum class CopyMethod
+{
+	Memcpy = 0,
+
+	// aarch64 non-temporal (STNP) stores of 64 byte groups that bypass
+	// the cache
+	Neon,
+
+	// SSE2 non-temporal stores that bypass the cache
+	Stream
+};
+
+
+typedef void (*CopyFunction)(void* destination, const void* source, size_t count);
+
+
+bool IsCopySupported(CopyMethod method);
+const char* CopyMethodName(CopyMethod method);
+CopyFunction GetCopyFunction(CopyMethod method);
+
+// Times every supported method copying source into destination and
+// returns the fastest. Both must stay valid for count bytes; the
+// destination ends up holding the source.
+CopyMethod SelectCopyMethod(void* destination, const void* source, size_t count, int iterations);
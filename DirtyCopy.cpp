@@ -0,0 +1,163 @@
+#include "DirtyCopy.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Exception.h"
+
+
+static bool TileEquals(const unsigned char* a, const unsigned char* b, size_t count)
+{
+	size_t i = 0;
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+	for (; i + 64 <= count; i += 64)
+	{
+		uint8x16_t d0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+		uint8x16_t d1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+		uint8x16_t d2 = veorq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32));
+		uint8x16_t d3 = veorq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48));
+
+		uint64x2_t d = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(d0, d1), vorrq_u8(d2, d3)));
+		if ((vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)) != 0)
+			return false;
+	}
+#elif defined(__SSE2__)
+	for (; i + 64 <= count; i += 64)
+	{
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+		__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+
+		__m128i e = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+		if (_mm_movemask_epi8(e) != 0xffff)
+			return false;
+	}
+#endif
+
+	return memcmp(a + i, b + i, count - i) == 0;
+}
+
+
+DirtyCopy::DirtyCopy(size_t length, CopyMethod method, size_t rowBytes, size_t destinationStride)
+	: length(length), rowBytes(rowBytes ? rowBytes : length),
+	destinationStride(destinationStride ? destinationStride : this->rowBytes),
+	method(method), copy(GetCopyFunction(method))
+{
+	if (length < 1)
+		throw Exception("length < 1");
+
+	if (!IsCopySupported(method))
+		throw Exception("copy method not supported");
+
+	if (this->destinationStride < this->rowBytes)
+		throw Exception("destinationStride < rowBytes");
+
+	// Tiles are page sized so that a deferred-io framebuffer (fbtft)
+	// only sees writes to the pages that actually changed.
+	tileSize = sysconf(_SC_PAGESIZE);
+	shadow.resize(length);
+}
+
+
+size_t DirtyCopy::Copy(void* destination, const void* source)
+{
+	unsigned char* dst = (unsigned char*)destination;
+	const unsigned char* src = (const unsigned char*)source;
+	unsigned char* shd = shadow.data();
+
+	if (!shadowValid)
+	{
+		memcpy(shd, src, length);
+		Write(dst, 0, length);
+
+		shadowValid = true;
+		bytesWritten += length;
+
+		return length;
+	}
+
+
+	// Coalesce adjacent dirty tiles into a single span
+	size_t written = 0;
+	size_t spanStart = 0;
+	size_t spanLength = 0;
+
+	for (size_t offset = 0; offset < length; offset += tileSize)
+	{
+		size_t count = length - offset;
+		if (count > tileSize)
+			count = tileSize;
+
+		if (TileEquals(src + offset, shd + offset, count))
+		{
+			if (spanLength > 0)
+			{
+				Write(dst, spanStart, spanLength);
+				written += spanLength;
+				spanLength = 0;
+			}
+		}
+		else
+		{
+			memcpy(shd + offset, src + offset, count);
+
+			if (spanLength == 0)
+				spanStart = offset;
+
+			spanLength += count;
+		}
+	}
+
+	if (spanLength > 0)
+	{
+		Write(dst, spanStart, spanLength);
+		written += spanLength;
+	}
+
+
+	bytesWritten += written;
+	bytesSkipped += length - written;
+
+	return written;
+}
+
+void DirtyCopy::Write(unsigned char* destination, size_t offset, size_t count)
+{
+	const unsigned char* shd = shadow.data();
+
+	if (destinationStride == rowBytes)
+	{
+		copy(destination + offset, shd + offset, count);
+		return;
+	}
+
+
+	// A span can start and end inside a row
+	while (count > 0)
+	{
+		size_t row = offset / rowBytes;
+		size_t column = offset % rowBytes;
+
+		size_t piece = rowBytes - column;
+		if (piece > count)
+			piece = count;
+
+		copy(destination + row * destinationStride + column, shd + offset, piece);
+
+		offset += piece;
+		count -= piece;
+	}
+}
+
+void DirtyCopy::Invalidate()
+{
+	shadowValid = false;
+}
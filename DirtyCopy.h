@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CopyKernels.h"
+
+
+// Copies a frame into a destination while skipping the tiles that are
+// unchanged since the last copy. A shadow of the last presented frame is
+// kept in ordinary (cached) memory so the comparison never reads back
+// from the destination.
+class DirtyCopy
+{
+	size_t length;
+	size_t rowBytes;
+	size_t destinationStride;
+	CopyMethod method;
+	CopyFunction copy;
+	size_t tileSize;
+	std::vector<unsigned char> shadow;
+	bool shadowValid = false;
+
+	unsigned long long bytesWritten = 0;
+	unsigned long long bytesSkipped = 0;
+
+
+	void Write(unsigned char* destination, size_t offset, size_t count);
+
+public:
+
+	size_t Length() const
+	{
+		return length;
+	}
+
+	size_t TileSize() const
+	{
+		return tileSize;
+	}
+
+	CopyMethod Method() const
+	{
+		return method;
+	}
+
+	unsigned long long BytesWritten() const
+	{
+		return bytesWritten;
+	}
+
+	unsigned long long BytesSkipped() const
+	{
+		return bytesSkipped;
+	}
+
+
+	// Frames are rows of rowBytes; destinationStride is the distance
+	// between rows in the destination. 0 means the frame is one row.
+	DirtyCopy(size_t length, CopyMethod method = CopyMethod::Memcpy,
+		size_t rowBytes = 0, size_t destinationStride = 0);
+
+
+	// Returns the number of bytes written to destination
+	size_t Copy(void* destination, const void* source);
+
+	// Forces the next Copy to write the whole frame
+	void Invalidate();
+};
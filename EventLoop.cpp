@@ -0,0 +1,192 @@
+#include "EventLoop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "Exception.h"
+
+
+EventLoop::EventLoop()
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0)
+	{
+		throw Exception("epoll_create1 failed.");
+	}
+
+	sigemptyset(&signals);
+}
+
+EventLoop::~EventLoop()
+{
+	for (Entry* entry : entries)
+	{
+		if (entry->Owned)
+			close(entry->Fd);
+
+		delete entry;
+	}
+
+	// Signals stay blocked; pending ones must not kill the process now
+	close(epollFd);
+}
+
+
+void EventLoop::Add(int fd, const Handler& handler, bool owned)
+{
+	Entry* entry = new Entry();
+	entry->Fd = fd;
+	entry->OnReady = handler;
+	entry->Owned = owned;
+
+	epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = entry;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		delete entry;
+		throw Exception("EPOLL_CTL_ADD failed.");
+	}
+
+	entries.push_back(entry);
+}
+
+void EventLoop::Watch(int fd, const Handler& handler)
+{
+	if (fd < 0)
+		throw Exception("invalid fd");
+
+	Add(fd, handler, false);
+}
+
+int EventLoop::AddTimer(const Handler& handler)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		throw Exception("timerfd_create failed.");
+	}
+
+	Handler expire = [fd, handler]()
+	{
+		uint64_t expirations;
+		if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+		{
+			handler();
+		}
+	};
+
+	try
+	{
+		Add(fd, expire, true);
+	}
+	catch (Exception&)
+	{
+		close(fd);
+		throw;
+	}
+
+	return fd;
+}
+
+void EventLoop::ArmTimer(int timer, double time, double interval)
+{
+	if (time < 0)
+		time = 0;
+
+	itimerspec spec = { 0 };
+	spec.it_value.tv_sec = (time_t)time;
+	spec.it_value.tv_nsec = (long)((time - spec.it_value.tv_sec) * 1e9);
+	spec.it_interval.tv_sec = (time_t)interval;
+	spec.it_interval.tv_nsec = (long)((interval - spec.it_interval.tv_sec) * 1e9);
+
+	// An all zero it_value would disarm the timer
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;
+
+	if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+	{
+		throw Exception("timerfd_settime failed.");
+	}
+}
+
+void EventLoop::OnSignal(int signal, const Handler& handler)
+{
+	sigaddset(&signals, signal);
+
+	if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0)
+	{
+		throw Exception("pthread_sigmask failed.");
+	}
+
+	bool created = (signalFd < 0);
+
+	signalFd = signalfd(signalFd, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signalFd < 0)
+	{
+		throw Exception("signalfd failed.");
+	}
+
+	if (created)
+	{
+		Add(signalFd, [this]() { HandleSignals(); }, true);
+	}
+
+	SignalHandler entry;
+	entry.Signal = signal;
+	entry.OnSignal = handler;
+
+	signalHandlers.push_back(entry);
+}
+
+void EventLoop::HandleSignals()
+{
+	signalfd_siginfo info;
+
+	while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+	{
+		for (const SignalHandler& entry : signalHandlers)
+		{
+			if (entry.Signal == (int)info.ssi_signo)
+				entry.OnSignal();
+		}
+	}
+}
+
+
+void EventLoop::Run()
+{
+	const int MAX_EVENTS = 16;
+	epoll_event events[MAX_EVENTS];
+
+	running = true;
+
+	while (running)
+	{
+		int count = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			throw Exception("epoll_wait failed.");
+		}
+
+		for (int i = 0; i < count && running; ++i)
+		{
+			Entry* entry = (Entry*)events[i].data.ptr;
+			entry->OnReady();
+		}
+	}
+}
+
+void EventLoop::Stop()
+{
+	running = false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <signal.h>
+#include <functional>
+#include <vector>
+
+
+// Runs handlers for readable file descriptors, timers and signals from a
+// single epoll wait, so the process sleeps until one of them is due.
+// Timers are timerfds on the GetTime() clock; signals arrive through a
+// signalfd and are blocked for every thread created after OnSignal.
+class EventLoop
+{
+public:
+
+	typedef std::function<void()> Handler;
+
+
+private:
+
+	struct Entry
+	{
+		int Fd;
+		Handler OnReady;
+		bool Owned;
+	};
+
+	struct SignalHandler
+	{
+		int Signal;
+		Handler OnSignal;
+	};
+
+
+	int epollFd = -1;
+	int signalFd = -1;
+	sigset_t signals;
+	std::vector<Entry*> entries;
+	std::vector<SignalHandler> signalHandlers;
+	bool running = false;
+
+
+	void Add(int fd, const Handler& handler, bool owned);
+	void HandleSignals();
+
+
+public:
+
+	bool IsRunning() const
+	{
+		return running;
+	}
+
+
+	EventLoop();
+	~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+
+	// Calls handler while fd is readable. The caller keeps owning fd.
+	void Watch(int fd, const Handler& handler);
+
+	// Returns a disarmed timer for ArmTimer
+	int AddTimer(const Handler& handler);
+
+	// Fires at time, then every interval when it is not 0. A time in the
+	// past fires at once.
+	void ArmTimer(int timer, double time, double interval = 0);
+
+	// Blocks signal and calls handler when it is delivered. Must be called
+	// before any thread is started.
+	void OnSignal(int signal, const Handler& handler);
+
+
+	// Dispatches events until Stop
+	void Run();
+	void Stop();
+};
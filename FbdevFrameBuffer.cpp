@@ -0,0 +1,234 @@
+#include "FbdevFrameBuffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include <linux/fb.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "Exception.h"
+
+
+#ifndef FBIOGET_DMABUF
+struct fb_dmabuf_export
+{
+	__u32 fd;
+	__u32 flags;
+};
+
+#define FBIOGET_DMABUF _IOR('F', 0x21, struct fb_dmabuf_export)
+#endif
+
+
+FbdevFrameBuffer::FbdevFrameBuffer(const char* deviceName, double refreshRate)
+	: FrameBuffer(deviceName), vsyncTimer(refreshRate)
+{
+	fd = open(deviceName, O_RDWR);
+	if (fd < 0)
+	{
+		throw Exception("open failed.");
+	}
+
+
+	LoadMode();
+}
+
+void FbdevFrameBuffer::LoadMode()
+{
+	int io;
+	struct fb_var_screeninfo info;
+
+	io = ioctl(fd, FBIOGET_VSCREENINFO, &info);
+	if (io < 0)
+	{
+		throw Exception("FBIOGET_VSCREENINFO failed.");
+	}
+
+
+	struct fb_fix_screeninfo fixInfo;
+
+	io = ioctl(fd, FBIOGET_FSCREENINFO, &fixInfo);
+	if (io < 0)
+	{
+		throw Exception("FBIOGET_FSCREENINFO failed.");
+	}
+
+	id = std::string(fixInfo.id, strnlen(fixInfo.id, sizeof(fixInfo.id)));
+	physicalAddress = fixInfo.smem_start;
+	physicalLength = fixInfo.smem_len;
+	lineLength = fixInfo.line_length;
+
+
+	width = info.xres;
+	height = info.yres;
+	bpp = info.bits_per_pixel;
+
+	// Channel order as the driver reports it rather than assumed
+	format = PixelFormat::Make(bpp, info.red.offset, info.red.length,
+		info.green.offset, info.green.length, info.blue.offset, info.blue.length);
+	stride = lineLength;
+	length = Stride() * height;
+
+
+	// Every page is mapped; Data() follows the one on display
+	virtualHeight = (info.yres_virtual > info.yres) ? info.yres_virtual : info.yres;
+	mappingLength = (size_t)lineLength * virtualHeight;
+
+	void* result = mmap(0, mappingLength, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+	if (result == MAP_FAILED)
+	{
+		throw Exception("mmap failed");
+	}
+
+	mapping = (unsigned char*)result;
+
+	UpdatePan(info);
+}
+
+void FbdevFrameBuffer::UpdatePan(const struct fb_var_screeninfo& info)
+{
+	int x = info.xoffset;
+	int y = info.yoffset;
+
+	// A page that does not fit the mapping is a driver in the middle of
+	// a mode change; stay on the first one.
+	if (x < 0 || y < 0 || (size_t)(y + height) * lineLength > mappingLength ||
+		x * format.BytesPerPixel() + width * format.BytesPerPixel() > lineLength)
+	{
+		x = 0;
+		y = 0;
+	}
+
+	xOffset = x;
+	yOffset = y;
+	data = mapping + (size_t)y * lineLength + x * format.BytesPerPixel();
+}
+
+FbdevFrameBuffer::~FbdevFrameBuffer()
+{
+	munmap(mapping, mappingLength);
+	close(fd);
+}
+
+
+bool FbdevFrameBuffer::IsDeferredIo() const
+{
+	// fbtft drivers are named fb_<chip>, flexfb or fbtft
+	const char* name = id.c_str();
+	if (strncmp(name, "fb_", 3) == 0 || strncmp(name, "flexfb", 6) == 0 || strncmp(name, "fbtft", 5) == 0)
+		return true;
+
+
+	// Otherwise ask sysfs which module drives the device
+	const char* device = strrchr(deviceName.c_str(), '/');
+	device = device ? device + 1 : deviceName.c_str();
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "/sys/class/graphics/%s/device/driver/module", device);
+
+	char target[PATH_MAX];
+	ssize_t count = readlink(path, target, sizeof(target) - 1);
+	if (count <= 0)
+		return false;
+
+	target[count] = 0;
+
+	const char* module = strrchr(target, '/');
+	module = module ? module + 1 : target;
+
+	return strncmp(module, "fb_", 3) == 0 || strcmp(module, "flexfb") == 0 || strcmp(module, "fbtft") == 0;
+}
+
+int FbdevFrameBuffer::ExportDmaBuf() const
+{
+	fb_dmabuf_export dmabuf = { 0 };
+
+	int io = ioctl(fd, FBIOGET_DMABUF, &dmabuf);
+	if (io < 0)
+		return -1;
+
+	return dmabuf.fd;
+}
+
+
+bool FbdevFrameBuffer::IsModeChanged()
+{
+	struct fb_var_screeninfo info;
+	struct fb_fix_screeninfo fixInfo;
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &info) < 0 ||
+		ioctl(fd, FBIOGET_FSCREENINFO, &fixInfo) < 0)
+	{
+		// Keep mirroring the mode that is known to work
+		return false;
+	}
+
+	PixelFormat current = PixelFormat::Make(info.bits_per_pixel, info.red.offset, info.red.length,
+		info.green.offset, info.green.length, info.blue.offset, info.blue.length);
+
+	int currentVirtualHeight = (info.yres_virtual > info.yres) ? info.yres_virtual : info.yres;
+
+	return (int)info.xres != width || (int)info.yres != height ||
+		current != format || (int)fixInfo.line_length != lineLength ||
+		currentVirtualHeight != virtualHeight;
+}
+
+void FbdevFrameBuffer::UpdateMode()
+{
+	munmap(mapping, mappingLength);
+	mapping = nullptr;
+	data = nullptr;
+
+	LoadMode();
+}
+
+
+void FbdevFrameBuffer::WaitForVSync()
+{
+	bool waited = false;
+
+	if (hasVSync)
+	{
+		int io = ioctl(fd, FBIO_WAITFORVSYNC, 0);
+		if (io == 0)
+		{
+			waited = true;
+		}
+		else
+		{
+			if (errno != ENOTTY && errno != EINVAL && errno != ENOSYS)
+			{
+				throw Exception("FBIO_WAITFORVSYNC failed.");
+			}
+
+
+			// The driver has no vsync interrupt
+			hasVSync = false;
+			fprintf(stderr, "%s: no FBIO_WAITFORVSYNC, using a %.1f Hz timer\n",
+				deviceName.c_str(), vsyncTimer.RefreshRate());
+		}
+	}
+
+	if (!waited)
+	{
+		vsyncTimer.Wait();
+	}
+
+
+	// FBIOPAN_DISPLAY takes effect at vsync, so the page on display now
+	// stays complete until the next one while the application draws into
+	// another page.
+	struct fb_var_screeninfo info;
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == 0 &&
+		((int)info.xoffset != xOffset || (int)info.yoffset != yOffset))
+	{
+		UpdatePan(info);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "FrameBuffer.h"
+#include "VSyncTimer.h"
+
+
+struct fb_var_screeninfo;
+
+
+class FbdevFrameBuffer : public FrameBuffer
+{
+	int fd;
+	bool hasVSync = true;
+	VSyncTimer vsyncTimer;
+	std::string id;
+	unsigned long physicalAddress = 0;
+	unsigned int physicalLength = 0;
+	int lineLength = 0;
+	int virtualHeight = 0;
+	unsigned char* mapping = nullptr;
+	size_t mappingLength = 0;
+
+
+	void LoadMode();
+	void UpdatePan(const struct fb_var_screeninfo& info);
+
+
+public:
+
+	int FileDescriptor() const
+	{
+		return fd;
+	}
+
+	bool HasVSync() const
+	{
+		return hasVSync;
+	}
+
+	// fb_fix_screeninfo.id
+	const std::string& Id() const
+	{
+		return id;
+	}
+
+	// fb_fix_screeninfo.smem_start, 0 when the driver does not expose it
+	unsigned long PhysicalAddress() const
+	{
+		return physicalAddress;
+	}
+
+	unsigned int PhysicalLength() const
+	{
+		return physicalLength;
+	}
+
+	// fb_fix_screeninfo.line_length
+	int LineLength() const
+	{
+		return lineLength;
+	}
+
+	// fb_var_screeninfo.yres_virtual, all pages together
+	int VirtualHeight() const
+	{
+		return virtualHeight;
+	}
+
+
+	FbdevFrameBuffer(const char* deviceName, double refreshRate);
+	virtual ~FbdevFrameBuffer();
+
+
+	// True for drivers (fbtft) that track CPU writes to the mapping with
+	// deferred io. Their memory is not physically contiguous and must not
+	// be written by DMA.
+	bool IsDeferredIo() const;
+
+	// Exports the framebuffer memory as a dma-buf (FBIOGET_DMABUF).
+	// Returns -1 when the driver does not support it.
+	int ExportDmaBuf() const;
+
+
+	virtual void WaitForVSync() override;
+
+	virtual bool IsModeChanged() override;
+	virtual void UpdateMode() override;
+};
@@ -1,15 +1,14 @@
 #include "FrameBuffer.h"
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
-
-#include <linux/fb.h>
+#include <stdio.h>
+#include <string.h>
 
+#include "FbdevFrameBuffer.h"
+#include "MappedFrameBuffer.h"
+#include "RawFrameBuffer.h"
 #include "Exception.h"
 
+
 FrameBuffer::FrameBuffer(const char* deviceName)
 {
 	if (deviceName == nullptr)
@@ -19,56 +18,65 @@ FrameBuffer::FrameBuffer(const char* deviceName)
 
 
 	this->deviceName = deviceName;
+}
 
 
-	fd = open(deviceName, O_RDWR);
-	if (fd < 0)
+FrameBuffer* FrameBuffer::Create(const char* spec, double refreshRate)
+{
+	if (spec == nullptr)
 	{
-		throw Exception("open failed.");
+		throw Exception("bad device name");
 	}
 
 
-	int io;
-	struct fb_var_screeninfo info;
+	std::string text = spec;
 
-	io = ioctl(fd, FBIOGET_VSCREENINFO, &info);
-	if (io < 0)
+	size_t colon = text.find(':');
+	if (colon == std::string::npos)
 	{
-		throw Exception("FBIOGET_VSCREENINFO failed.");
+		return new FbdevFrameBuffer(spec, refreshRate);
 	}
 
+	std::string type = text.substr(0, colon);
+	std::string name = text.substr(colon + 1);
 
-	width = info.xres;
-	height = info.yres;
-	bpp = info.bits_per_pixel;
-	length = width * height * (bpp / 8);
 
+	// Geometry
+	int width;
+	int height;
+	int bpp;
 
-	data = mmap(0, length, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
-	if (data == MAP_FAILED)
+	size_t at = name.rfind('@');
+	if (at == std::string::npos ||
+		sscanf(name.c_str() + at + 1, "%dx%dx%d", &width, &height, &bpp) != 3 ||
+		width < 1 || height < 1 || !PixelFormat::FromBitsPerPixel(bpp).IsSupported())
 	{
-		throw Exception("mmap failed");
+		throw Exception("framebuffer geometry must be given as @WxHxBPP");
 	}
-}
 
-FrameBuffer::~FrameBuffer()
-{
-	int r = munmap(data, length);
-	if (r != 0)
-	{
-		throw Exception("munmap failed.");
-	}
-
-	close(fd);
-}
+	name = name.substr(0, at);
 
 
-void FrameBuffer::WaitForVSync()
-{
-	int io = ioctl(fd, FBIO_WAITFORVSYNC, 0);
-	if (io < 0)
+	if (type == "file")
+	{
+		return new MappedFrameBuffer(MappedFrameBufferType::File, name.c_str(), width, height, PixelFormat::FromBitsPerPixel(bpp), refreshRate);
+	}
+	else if (type == "shm")
+	{
+		return new MappedFrameBuffer(MappedFrameBufferType::SharedMemory, name.c_str(), width, height, PixelFormat::FromBitsPerPixel(bpp), refreshRate);
+	}
+	else if (type == "memfd")
 	{
-		throw Exception("FBIO_WAITFORVSYNC failed.");
+		return new MappedFrameBuffer(MappedFrameBufferType::Anonymous, name.c_str(), width, height, PixelFormat::FromBitsPerPixel(bpp), refreshRate);
+	}
+	else if (type == "raw")
+	{
+		return new RawFrameBuffer(name.c_str(), width, height, PixelFormat::FromBitsPerPixel(bpp), refreshRate);
+	}
+	else if (type == "fbdev")
+	{
+		return new FbdevFrameBuffer(name.c_str(), refreshRate);
 	}
 
-}
\ No newline at end of file
+	throw Exception("unknown framebuffer type");
+}
@@ -2,15 +2,26 @@
 
 #include <string>
 
+#include "PixelFormat.h"
+
+
+// A mapped frame of pixels used as the mirror source or sink.
 class FrameBuffer
 {
+protected:
 	std::string deviceName;
-	int fd;
-	int width;
-	int height;
-	int bpp;
-	int length;
-	void* data;
+	int width = 0;
+	int height = 0;
+	int bpp = 0;
+	PixelFormat format;
+	int stride = 0;
+	int length = 0;
+	int xOffset = 0;
+	int yOffset = 0;
+	void* data = nullptr;
+
+
+	FrameBuffer(const char* deviceName);
 
 
 public:
@@ -20,11 +31,6 @@ public:
 		return deviceName;
 	}
 
-	int FileDescriptor() const
-	{
-		return fd;
-	}
-
 	int Width() const
 	{
 		return width;
@@ -40,20 +46,76 @@ public:
 		return bpp;
 	}
 
+	// Channel layout of a pixel
+	const PixelFormat& Format() const
+	{
+		return format;
+	}
+
+	// Bytes from one row to the next
+	int Stride() const
+	{
+		return stride ? stride : width * format.BytesPerPixel();
+	}
+
+	// Bytes of one page
 	int Length() const
 	{
 		return length;
 	}
 
+	// The page on display
 	void* Data() const
 	{
 		return data;
 	}
 
+	// Where that page starts in a panned framebuffer
+	int XOffset() const
+	{
+		return xOffset;
+	}
+
+	int YOffset() const
+	{
+		return yOffset;
+	}
+
+
+	virtual ~FrameBuffer()
+	{
+	}
+
+
+	// Opens a framebuffer from a specification:
+	//   /dev/fbN                     fbdev device
+	//   file:PATH@WxHxBPP            plain file, created if needed
+	//                                (BPP 18 is RGB666 in three bytes)
+	//   shm:NAME@WxHxBPP             POSIX shared memory (/dev/shm/NAME)
+	//   memfd:NAME@WxHxBPP           anonymous memory
+	//   raw:PATH@WxHxBPP             raw image sequence; PATH is either a
+	//                                printf pattern (frame%04d.raw) or a
+	//                                file of concatenated frames
+	// refreshRate is used by framebuffers without a vsync interrupt.
+	static FrameBuffer* Create(const char* spec, double refreshRate);
 
-	FrameBuffer(const char* deviceName);
-	~FrameBuffer();
 
+	virtual void WaitForVSync() = 0;
 
-	void WaitForVSync();
+	// Called after a new frame has been written
+	virtual void Present()
+	{
+	}
+
+	// Cheap check whether the mode (size, depth, layout) changed since it
+	// was read. Nothing is remapped.
+	virtual bool IsModeChanged()
+	{
+		return false;
+	}
+
+	// Reads the new mode and remaps Data()
+	virtual void UpdateMode()
+	{
+	}
 };
@@ -0,0 +1,84 @@
+#include "FramePacer.h"
+
+#include <stdio.h>
+
+#include "FbdevFrameBuffer.h"
+#include "Exception.h"
+
+
+static int ReadIntFile(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (file == nullptr)
+		return -1;
+
+	int value = -1;
+	if (fscanf(file, "%d", &value) != 1)
+		value = -1;
+
+	fclose(file);
+
+	return value;
+}
+
+
+FramePacer::FramePacer(double targetRate)
+	: targetRate(targetRate)
+{
+	if (targetRate < 0)
+		throw Exception("targetRate < 0");
+
+	period = (targetRate > 0) ? 1.0 / targetRate : 0;
+}
+
+
+double FramePacer::DetectRefreshRate(const FrameBuffer& sink)
+{
+	// fbtft flushes its deferred io at most 'fps' times per second
+	// (fbtft_device fps=, 20 when not given). Writing faster than that
+	// only produces frames that are coalesced away. Other sinks, such as
+	// an HDMI or native panel next to the LCD, are not paced.
+	const FbdevFrameBuffer* fb = dynamic_cast<const FbdevFrameBuffer*>(&sink);
+	if (fb == nullptr || !fb->IsDeferredIo())
+		return 0;
+
+	int fps = ReadIntFile("/sys/module/fbtft_device/parameters/fps");
+	if (fps <= 0)
+		fps = 20;
+
+	return fps;
+}
+
+
+bool FramePacer::IsDue(double now, double sourcePeriod)
+{
+	// The sink can not present faster than it takes to present a frame
+	double effective = period;
+	if (effective > 0 && presentTime > effective)
+		effective = presentTime;
+
+	if (effective == 0)
+		return true;
+
+
+	// Accept a frame up to half a source interval early so the output
+	// does not beat against the source rate.
+	if (now + sourcePeriod / 2 < next)
+		return false;
+
+	next += effective;
+	if (next < now)
+		next = now + effective;
+
+	return true;
+}
+
+void FramePacer::AddPresentTime(double seconds)
+{
+	const double SMOOTHING = 0.1;
+
+	if (presentTime == 0)
+		presentTime = seconds;
+	else
+		presentTime += (seconds - presentTime) * SMOOTHING;
+}
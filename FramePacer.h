@@ -0,0 +1,51 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+
+// Decides which source frames are converted and presented so the output
+// rate matches what the sink can actually display.
+class FramePacer
+{
+	double targetRate;
+	double period;
+	double next = 0;
+	double presentTime = 0;
+
+
+public:
+
+	// Rate currently paced to, 0 when every frame is produced
+	double Rate() const
+	{
+		return (period > 0) ? 1.0 / period : 0;
+	}
+
+	double TargetRate() const
+	{
+		return targetRate;
+	}
+
+	// Smoothed time taken to present one frame
+	double PresentTime() const
+	{
+		return presentTime;
+	}
+
+
+	// A rate of 0 disables pacing
+	FramePacer(double targetRate);
+
+
+	// Refresh rate of the panel behind the sink, 0 if it is not limited
+	// below the source rate.
+	static double DetectRefreshRate(const FrameBuffer& sink);
+
+
+	// Returns true when the source frame at time now should be produced.
+	// sourcePeriod is the interval between source frames.
+	bool IsDue(double now, double sourcePeriod);
+
+	// Reports how long presenting a frame took
+	void AddPresentTime(double seconds);
+};
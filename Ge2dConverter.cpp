@@ -0,0 +1,570 @@
+#include "Ge2dConverter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "ge2d_cmd.h"
+#include "FbdevFrameBuffer.h"
+#include "Exception.h"
+#include "Tracer.h"
+
+
+// The byte of a channel that sits in the top bits of that byte, or -1.
+// Narrower channels (RGB666) are written as full bytes whose low bits the
+// panel ignores.
+static int ChannelByte(const PixelChannel& channel)
+{
+	int end = channel.Offset + channel.Length;
+	if (end % 8 != 0 || channel.Length > 8)
+		return -1;
+
+	return end / 8 - 1;
+}
+
+// GE2D format with the layout of format, or -1. The 24 and 32 bpp GE2D
+// names count from the most significant byte, so GE2D "RGB" is fbdev
+// red at offset 16.
+static int Ge2dFormat(const PixelFormat& format)
+{
+	if (format == PixelFormat::Rgb565())
+		return GE2D_FORMAT_S16_RGB_565;
+
+	if (format.BitsPerPixel != 24 && format.BitsPerPixel != 32)
+		return -1;
+
+	int red = ChannelByte(format.Red);
+	int green = ChannelByte(format.Green);
+	int blue = ChannelByte(format.Blue);
+
+	if (green != 1)
+		return -1;
+
+	bool rgb = (red == 2 && blue == 0);
+	bool bgr = (red == 0 && blue == 2);
+
+	if (format.BitsPerPixel == 24)
+	{
+		if (rgb)
+			return GE2D_FORMAT_S24_RGB;
+
+		if (bgr)
+			return GE2D_FORMAT_S24_BGR;
+	}
+	else
+	{
+		if (rgb)
+			return GE2D_FORMAT_S32_ARGB;
+
+		if (bgr)
+			return GE2D_FORMAT_S32_ABGR;
+	}
+
+	return -1;
+}
+
+// The op of GE2D_BLEND: color and alpha equations with their source and
+// destination factors
+static int BlendOp(int colorMode, int colorSource, int colorDestination,
+	int alphaMode, int alphaSource, int alphaDestination)
+{
+	return (colorMode << 24) | (colorSource << 20) | (colorDestination << 16) |
+		(alphaMode << 8) | (alphaSource << 4) | alphaDestination;
+}
+
+
+Ge2dConverter::Ge2dConverter(const FrameBuffer& source, int width, int height, const PixelFormat& format,
+	const Rectangle& destination, int bufferCount,
+	IonCacheMode cacheMode, const Transform& transform)
+	: bufferCount(bufferCount), width(width), height(height), format(format),
+	bytesPerPixel(format.BytesPerPixel()), transform(transform), logicalDestination(destination),
+	errors(0), written(bufferCount)
+{
+	if (bufferCount < 1)
+		throw Exception("bufferCount < 1");
+
+
+	// Ion
+	// All output buffers are stacked vertically in a single allocation
+	// followed by one scratch line used as the target of fence blits.
+	// Selecting a buffer is then only a matter of dst_rect.y and GE2D
+	// never needs to be reconfigured.
+	frameLength = width * height * bytesPerPixel;
+
+	int totalHeight = height * bufferCount + 1;
+
+	block = IonPool::Instance().Allocate((size_t)width * totalHeight * bytesPerPixel, cacheMode);
+	bufferPtr = block.Data();
+
+	Configure(source, width, totalHeight, block.PhysicalAddress(), transform.Map(destination, width, height));
+}
+
+Ge2dConverter::Ge2dConverter(const FrameBuffer& source, int width, int height, const PixelFormat& format,
+	const Rectangle& destination, unsigned long targetAddress, void* targetData,
+	const Transform& transform)
+	: bufferCount(1), width(width), height(height), format(format),
+	bytesPerPixel(format.BytesPerPixel()), transform(transform), logicalDestination(destination),
+	errors(0), written(1)
+{
+	if (targetAddress == 0 || targetData == nullptr)
+		throw Exception("invalid target");
+
+	frameLength = width * height * bytesPerPixel;
+	bufferPtr = (unsigned char*)targetData;
+
+	Configure(source, width, height, targetAddress, transform.Map(destination, width, height));
+}
+
+
+void Ge2dConverter::Configure(const FrameBuffer& source, int width, int totalHeight, unsigned long address, const Rectangle& destination)
+{
+	// Configure GE2D
+	struct config_para_ex_s configex = { 0 };
+
+	int sourceFormat = Ge2dFormat(source.Format());
+	if (sourceFormat < 0)
+	{
+		throw Exception("fb0 pixel format not supported");
+	}
+
+	int destinationFormat = Ge2dFormat(format);
+	if (destinationFormat < 0)
+	{
+		throw Exception("output pixel format not supported by GE2D");
+	}
+
+	configex.src_para.format = sourceFormat;
+
+	sourceWidth = source.Width();
+	sourceHeight = source.Height();
+
+	// The OSD0 canvas spans every page of a panned fb0. It is configured
+	// once; the blit follows the displayed page through src1_rect.
+	int canvasHeight = source.Height();
+
+	const FbdevFrameBuffer* fbdev = dynamic_cast<const FbdevFrameBuffer*>(&source);
+	if (fbdev != nullptr && fbdev->VirtualHeight() > canvasHeight)
+	{
+		canvasHeight = fbdev->VirtualHeight();
+	}
+
+	configex.src_para.mem_type = CANVAS_OSD0;
+	configex.src_para.left = 0;
+	configex.src_para.top = 0;
+	configex.src_para.width = source.Width();
+	configex.src_para.height = canvasHeight;
+
+	configex.src2_para.mem_type = CANVAS_TYPE_INVALID;
+
+	outputAddress = address;
+	outputHeight = totalHeight;
+	ConfigureOutput(configex);
+
+
+	// Opened last: the destructor does not run when a constructor throws,
+	// so nothing may throw while the fd is open
+	ge2d_fd = open("/dev/ge2d", O_RDWR);
+	if (ge2d_fd < 0)
+	{
+		throw Exception("open /dev/ge2d failed.");
+	}
+
+	int io = ioctl(ge2d_fd, GE2D_CONFIG_EX, &configex);
+	if (io < 0)
+	{
+		close(ge2d_fd);
+		ge2d_fd = -1;
+		throw Exception("GE2D_CONFIG_EX failed.\n");
+	}
+
+
+	destinationY = destination.Y;
+	destinationHeight = destination.Height;
+
+
+	//  Blit rectangle
+	sourceRect = { 0, 0, source.Width(), source.Height() };
+	sourceX = source.XOffset();
+	sourceY = source.YOffset();
+
+	blitRect.src1_rect.x = sourceX;
+	blitRect.src1_rect.y = sourceY;
+	blitRect.src1_rect.w = source.Width();
+	blitRect.src1_rect.h = source.Height();
+
+	blitRect.dst_rect.x = destination.X;
+	blitRect.dst_rect.y = destination.Y;
+	blitRect.dst_rect.w = destination.Width;
+	blitRect.dst_rect.h = destination.Height;
+
+
+	// Fence rectangle
+	fenceRect.src1_rect.x = 0;
+	fenceRect.src1_rect.y = 0;
+	fenceRect.src1_rect.w = 1;
+	fenceRect.src1_rect.h = 1;
+
+	fenceRect.dst_rect.x = 0;
+	fenceRect.dst_rect.y = height * bufferCount;
+	fenceRect.dst_rect.w = 1;
+	fenceRect.dst_rect.h = 1;
+}
+
+void Ge2dConverter::ConfigureOutput(config_para_ex_s& configex) const
+{
+	configex.dst_para.mem_type = CANVAS_ALLOC;
+	configex.dst_para.format = Ge2dFormat(format);
+	configex.dst_para.left = 0;
+	configex.dst_para.top = 0;
+	configex.dst_para.width = width;
+	configex.dst_para.height = outputHeight;
+	configex.dst_planes[0].addr = outputAddress;
+	configex.dst_planes[0].w = width;
+	configex.dst_planes[0].h = outputHeight;
+
+	// Rotation and mirroring are part of the blit. The swap transposes the
+	// output, the reversals then turn the transpose into a clockwise
+	// rotation. dst_rect stays in output buffer coordinates.
+	bool reverseX = transform.FlipX;
+	bool reverseY = transform.FlipY;
+
+	switch (transform.Rotation)
+	{
+		case 90:
+			configex.dst_xy_swap = 1;
+			configex.dst_para.x_rev = !reverseY;
+			configex.dst_para.y_rev = reverseX;
+			break;
+
+		case 180:
+			configex.dst_para.x_rev = !reverseX;
+			configex.dst_para.y_rev = !reverseY;
+			break;
+
+		case 270:
+			configex.dst_xy_swap = 1;
+			configex.dst_para.x_rev = reverseY;
+			configex.dst_para.y_rev = !reverseX;
+			break;
+
+		default:
+			configex.dst_para.x_rev = reverseX;
+			configex.dst_para.y_rev = reverseY;
+			break;
+	}
+}
+
+Ge2dConverter::~Ge2dConverter()
+{
+	// The block goes back to the pool for the next converter
+	if (blend_fd >= 0)
+		close(blend_fd);
+
+	close(ge2d_fd);
+}
+
+
+bool Ge2dConverter::IsAvailable()
+{
+	return access("/dev/ge2d", R_OK | W_OK) == 0 &&
+		access("/dev/ion", R_OK | W_OK) == 0;
+}
+
+bool Ge2dConverter::IsSupported(const PixelFormat& format)
+{
+	return Ge2dFormat(format) >= 0;
+}
+
+void Ge2dConverter::SetSourceRect(const Rectangle& rect)
+{
+	if (rect.X < 0 || rect.Y < 0 || rect.Width < 1 || rect.Height < 1 ||
+		rect.X + rect.Width > sourceWidth || rect.Y + rect.Height > sourceHeight)
+	{
+		throw Exception("invalid source rectangle");
+	}
+
+	// The canvas stays configured for the whole of fb0; only the blit
+	// reads less of it.
+	sourceRect = rect;
+
+	blitRect.src1_rect.x = sourceX + rect.X;
+	blitRect.src1_rect.y = sourceY + rect.Y;
+	blitRect.src1_rect.w = rect.Width;
+	blitRect.src1_rect.h = rect.Height;
+
+	if (blend_fd >= 0)
+		UpdateBlendRect();
+}
+
+void Ge2dConverter::SetSourceOffset(int x, int y)
+{
+	sourceX = x;
+	sourceY = y;
+
+	blitRect.src1_rect.x = sourceX + sourceRect.X;
+	blitRect.src1_rect.y = sourceY + sourceRect.Y;
+}
+
+void Ge2dConverter::SetOverlay(const FrameBuffer& overlay)
+{
+	if (blend_fd >= 0)
+		throw Exception("overlay already set");
+
+	if (overlay.Format() != PixelFormat::Xrgb8888())
+		throw Exception("overlay must be 32 bpp ARGB");
+
+	const FbdevFrameBuffer* fbdev = dynamic_cast<const FbdevFrameBuffer*>(&overlay);
+	if (fbdev == nullptr)
+		throw Exception("ge2d overlay requires an fbdev overlay");
+
+
+	blend_fd = open("/dev/ge2d", O_RDWR);
+	if (blend_fd < 0)
+	{
+		throw Exception("open /dev/ge2d failed.");
+	}
+
+	// src1 is OSD1, scaled like OSD0. src2 is the scaled image the
+	// blend is written back over, read with the same geometry as dst.
+	struct config_para_ex_s configex = { 0 };
+
+	configex.src_para.mem_type = CANVAS_OSD1;
+	configex.src_para.format = GE2D_FORMAT_S32_ARGB;
+	configex.src_para.left = 0;
+	configex.src_para.top = 0;
+	configex.src_para.width = overlay.Width();
+	configex.src_para.height = fbdev->VirtualHeight() > overlay.Height() ? fbdev->VirtualHeight() : overlay.Height();
+
+	ConfigureOutput(configex);
+
+	configex.src2_para = configex.dst_para;
+	configex.src2_planes[0] = configex.dst_planes[0];
+
+	int io = ioctl(blend_fd, GE2D_CONFIG_EX, &configex);
+	if (io < 0)
+	{
+		close(blend_fd);
+		blend_fd = -1;
+		throw Exception("GE2D_CONFIG_EX failed.\n");
+	}
+
+	overlayWidth = overlay.Width();
+	overlayHeight = overlay.Height();
+	overlayX = overlay.XOffset();
+	overlayY = overlay.YOffset();
+
+	blendRect.op = BlendOp(OPERATION_ADD, COLOR_FACTOR_SRC_ALPHA, COLOR_FACTOR_ONE_MINUS_SRC_ALPHA,
+		OPERATION_ADD, ALPHA_FACTOR_ONE, ALPHA_FACTOR_ONE_MINUS_SRC_ALPHA);
+
+	UpdateBlendRect();
+}
+
+void Ge2dConverter::UpdateBlendRect()
+{
+	// OSD1 covers the top left of OSD0
+	int left = sourceRect.X;
+	int top = sourceRect.Y;
+	int right = sourceRect.X + sourceRect.Width;
+	int bottom = sourceRect.Y + sourceRect.Height;
+
+	if (right > overlayWidth)
+		right = overlayWidth;
+	if (bottom > overlayHeight)
+		bottom = overlayHeight;
+
+	blendRect.dst_rect.w = 0;
+
+	if (right <= left || bottom <= top)
+		return;
+
+
+	// Scaled into the logical destination like the mirrored region
+	double scaleX = (double)logicalDestination.Width / sourceRect.Width;
+	double scaleY = (double)logicalDestination.Height / sourceRect.Height;
+
+	int x0 = (int)lround((left - sourceRect.X) * scaleX);
+	int y0 = (int)lround((top - sourceRect.Y) * scaleY);
+	int x1 = (int)lround((right - sourceRect.X) * scaleX);
+	int y1 = (int)lround((bottom - sourceRect.Y) * scaleY);
+
+	if (x1 <= x0 || y1 <= y0)
+		return;
+
+	Rectangle logical = { logicalDestination.X + x0, logicalDestination.Y + y0, x1 - x0, y1 - y0 };
+	Rectangle output = transform.Map(logical, width, height);
+
+
+	blendRect.src1_rect.x = overlayX + left;
+	blendRect.src1_rect.y = overlayY + top;
+	blendRect.src1_rect.w = right - left;
+	blendRect.src1_rect.h = bottom - top;
+
+	blendRect.dst_rect.x = output.X;
+	blendRect.dst_rect.w = output.Width;
+	blendRect.dst_rect.h = output.Height;
+	blendY = output.Y;
+
+	blendRect.src2_rect = blendRect.dst_rect;
+}
+
+void Ge2dConverter::Blend(int index)
+{
+	blendRect.dst_rect.y = index * height + blendY;
+	blendRect.src2_rect.y = blendRect.dst_rect.y;
+
+	if (bufferCount == 1)
+	{
+		TraceScope trace("ge2d blend", "ge2d", index);
+		int io = ioctl(blend_fd, GE2D_BLEND, &blendRect);
+		if (io < 0)
+		{
+			Fail("GE2D_BLEND failed.");
+			return;
+		}
+
+		consecutiveErrors = 0;
+		Invalidate(index);
+	}
+	else
+	{
+		TraceScope trace("ge2d blend submit", "ge2d", index);
+		int io = ioctl(blend_fd, GE2D_BLEND_NOBLOCK, &blendRect);
+		if (io < 0)
+		{
+			Fail("GE2D_BLEND_NOBLOCK failed.");
+			return;
+		}
+
+		consecutiveErrors = 0;
+
+		written[index] = true;
+		blendPending = true;
+	}
+}
+
+void Ge2dConverter::Convert(int index)
+{
+	if (index < 0 || index >= bufferCount)
+		throw Exception("invalid buffer index");
+
+
+	blitRect.dst_rect.y = index * height + destinationY;
+
+	// The contexts are not ordered against each other, so the blit the
+	// blend reads back has to complete first
+	bool blend = (blend_fd >= 0 && blendRect.dst_rect.w > 0);
+
+	if (bufferCount == 1 || blend)
+	{
+		// Nothing to overlap with; keep the original blocking blit.
+		TraceScope trace("ge2d blit", "ge2d", index);
+		int io = ioctl(ge2d_fd, GE2D_STRETCHBLIT_NOALPHA, &blitRect);
+		if (io < 0)
+		{
+			Fail("GE2D_STRETCHBLIT_NOALPHA failed.");
+			return;
+		}
+
+		consecutiveErrors = 0;
+
+		if (blend)
+			Blend(index);
+		else
+			Invalidate(index);
+	}
+	else
+	{
+		TraceScope trace("ge2d submit", "ge2d", index);
+		int io = ioctl(ge2d_fd, GE2D_STRETCHBLIT_NOALPHA_NOBLOCK, &blitRect);
+		if (io < 0)
+		{
+			Fail("GE2D_STRETCHBLIT_NOALPHA_NOBLOCK failed.");
+			return;
+		}
+
+		consecutiveErrors = 0;
+
+		written[index] = true;
+		pending = true;
+	}
+}
+
+void Ge2dConverter::Wait()
+{
+	if (!pending && !blendPending)
+		return;
+
+
+	// The GE2D driver runs the commands of a context in order, so the
+	// completion of a blocking blit implies that every non-blocking blit
+	// queued before it has completed as well. Each context with queued
+	// commands is fenced.
+	TraceScope trace("ge2d fence", "ge2d");
+
+	if (pending)
+	{
+		int io = ioctl(ge2d_fd, GE2D_STRETCHBLIT_NOALPHA, &fenceRect);
+		if (io < 0)
+		{
+			// Still pending; the next Wait fences the queued blits again
+			Fail("GE2D_STRETCHBLIT_NOALPHA failed.");
+			return;
+		}
+
+		pending = false;
+	}
+
+	if (blendPending)
+	{
+		int io = ioctl(blend_fd, GE2D_STRETCHBLIT_NOALPHA, &fenceRect);
+		if (io < 0)
+		{
+			Fail("GE2D_STRETCHBLIT_NOALPHA failed.");
+			return;
+		}
+
+		blendPending = false;
+	}
+
+	consecutiveErrors = 0;
+
+	for (int i = 0; i < bufferCount; ++i)
+	{
+		if (written[i])
+		{
+			Invalidate(i);
+			written[i] = false;
+		}
+	}
+}
+
+void Ge2dConverter::Fail(const char* message)
+{
+	const int MAX_CONSECUTIVE_ERRORS = 30;
+
+	++errors;
+	++consecutiveErrors;
+
+	if (consecutiveErrors >= MAX_CONSECUTIVE_ERRORS)
+	{
+		throw Exception(message);
+	}
+
+	if (consecutiveErrors == 1)
+	{
+		fprintf(stderr, "ge2d: %s (%llu errors)\n", message, (unsigned long long)errors);
+	}
+}
+
+void Ge2dConverter::Invalidate(int index)
+{
+	if (!block.IsValid())
+		return;
+
+	// Only the rows of the destination rectangle were written
+	size_t rowLength = (size_t)width * bytesPerPixel;
+	size_t offset = ((size_t)index * height + destinationY) * rowLength;
+	block.InvalidateRange(bufferPtr + offset, (size_t)destinationHeight * rowLength);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "Converter.h"
+#include "FrameBuffer.h"
+#include "IonPool.h"
+#include "ge2d.h"
+
+
+class Ge2dConverter : public Converter
+{
+	int ge2d_fd = -1;
+	int bufferCount;
+	size_t frameLength;
+	IonBlock block;
+	unsigned char* bufferPtr = nullptr;
+	ge2d_para_s blitRect = { 0 };
+	ge2d_para_s fenceRect = { 0 };
+	int sourceWidth;
+	int sourceHeight;
+	Rectangle sourceRect;
+	int sourceX = 0;
+	int sourceY = 0;
+	int destinationY;
+	int destinationHeight;
+	int width;
+	int height;
+	PixelFormat format;
+	int bytesPerPixel;
+	Transform transform;
+	bool pending = false;
+
+	// Output canvas and the logical destination, shared by the blend
+	unsigned long outputAddress = 0;
+	int outputHeight = 0;
+	Rectangle logicalDestination;
+
+	// OSD1 blend. It runs on a context of its own after the scaling blit
+	// completed, since it reads the scaled image back as src2.
+	int blend_fd = -1;
+	ge2d_para_s blendRect = { 0 };
+	int overlayWidth = 0;
+	int overlayHeight = 0;
+	int overlayX = 0;
+	int overlayY = 0;
+	int blendY = 0;
+	bool blendPending = false;
+
+	// Failed blits; a frame is lost, but only a run of them is fatal
+	std::atomic<unsigned long long> errors;
+	int consecutiveErrors = 0;
+
+	// Buffers written since the last Wait whose cached lines are stale
+	std::vector<bool> written;
+
+
+	void Invalidate(int index);
+
+	// Counts a failed ioctl; throws message after too many in a row
+	void Fail(const char* message);
+
+	// destination is in output buffer coordinates
+	void Configure(const FrameBuffer& source, int width, int totalHeight, unsigned long address, const Rectangle& destination);
+
+	// dst_para, the planes and the rotation of the output canvas
+	void ConfigureOutput(config_para_ex_s& configex) const;
+
+	// Maps the part of OSD1 over the mirrored region into blendRect
+	void UpdateBlendRect();
+	void Blend(int index);
+
+
+public:
+
+	virtual const char* Name() const override
+	{
+		return "ge2d";
+	}
+
+	virtual int BufferCount() const override
+	{
+		return bufferCount;
+	}
+
+	virtual void* Output(int index) const override
+	{
+		return bufferPtr + index * frameLength;
+	}
+
+	virtual size_t OutputLength() const override
+	{
+		return frameLength;
+	}
+
+
+	// Invalid for the zero-copy target
+	const IonBlock& Block() const
+	{
+		return block;
+	}
+
+
+	// destination is in the logical image, which transform rotates and
+	// flips into the width x height output buffers.
+	Ge2dConverter(const FrameBuffer& source, int width, int height, const PixelFormat& format,
+		const Rectangle& destination, int bufferCount,
+		IonCacheMode cacheMode = IonCacheMode::Default, const Transform& transform = Transform());
+
+	// Converts straight into external physically contiguous memory
+	// (the LCD framebuffer) with blocking blits.
+	Ge2dConverter(const FrameBuffer& source, int width, int height, const PixelFormat& format,
+		const Rectangle& destination, unsigned long targetAddress, void* targetData,
+		const Transform& transform = Transform());
+	virtual ~Ge2dConverter();
+
+
+	static bool IsAvailable();
+
+	// True when GE2D can read or write pixels of format
+	static bool IsSupported(const PixelFormat& format);
+
+	virtual void SetSourceRect(const Rectangle& rect) override;
+	virtual void SetSourceOffset(int x, int y) override;
+
+	// Composites the OSD1 canvas of overlay, an ARGB8888 framebuffer
+	// laid over OSD0 at its origin, into every converted frame with
+	// GE2D_BLEND. It is scaled like OSD0 and blended by its alpha.
+	void SetOverlay(const FrameBuffer& overlay);
+
+	virtual void Convert(int index) override;
+	virtual void Wait() override;
+
+	virtual unsigned long long Errors() const override
+	{
+		return errors;
+	}
+};
@@ -20,6 +20,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "ion.h"
 #include "meson_ion.h"
@@ -28,11 +31,29 @@
 
 
 
+// How the CPU mapping of a buffer is cached
+enum class IonCacheMode
+{
+	// Cached on aarch64, write-combined elsewhere
+	Default = 0,
+
+	// Cached; reads after a DMA write need InvalidateRange
+	Cached,
+
+	// ION's mapping of an uncached buffer
+	WriteCombine,
+
+	// Strongly ordered mapping through /dev/mem
+	Uncached
+};
+
+
 class IonBuffer
 {
 	size_t bufferSize = 0;
+	IonCacheMode cacheMode;
 	ion_user_handle_t handle = 0;
-	int exportHandle = 0;
+	int exportHandle = -1;
 	size_t length = 0;
 	unsigned long physicalAddress = 0;
 
@@ -40,6 +61,43 @@ class IonBuffer
 	static int ion_fd; // = -1;
 
 
+	// Destructors must not throw; a failed free is only reported.
+	static void Free(ion_user_handle_t handle)
+	{
+		ion_handle_data ionHandleData = { 0 };
+		ionHandleData.handle = handle;
+
+		int io = ioctl(ion_fd, ION_IOC_FREE, &ionHandleData);
+		if (io != 0)
+		{
+			fprintf(stderr, "ion: ION_IOC_FREE failed.\n");
+		}
+	}
+
+	void Release()
+	{
+		if (exportHandle >= 0)
+		{
+			close(exportHandle);
+		}
+
+		if (handle != 0)
+		{
+			Free(handle);
+		}
+
+		Forget();
+	}
+
+	void Forget()
+	{
+		handle = 0;
+		exportHandle = -1;
+		length = 0;
+		physicalAddress = 0;
+	}
+
+
 public:
 
 	size_t BufferSize() const
@@ -67,10 +125,15 @@ public:
 		return physicalAddress;
 	}
 
+	IonCacheMode CacheMode() const
+	{
+		return cacheMode;
+	}
 
 
-	IonBuffer(size_t bufferSize)
-		: bufferSize(bufferSize)
+
+	IonBuffer(size_t bufferSize, IonCacheMode cacheMode = IonCacheMode::Default)
+		: bufferSize(bufferSize), cacheMode(cacheMode)
 	{
 		if (bufferSize < 1)
 			throw Exception("bufferSize < 1");
@@ -93,11 +156,22 @@ public:
 		allocation_data.len = bufferSize;
 		allocation_data.heap_id_mask = ION_HEAP_CARVEOUT_MASK;
 
-#if defined(__aarch64__)
-		allocation_data.flags = ION_FLAG_CACHED_NEEDS_SYNC; //ION_FLAG_CACHED;
-#else
-		allocation_data.flags = 0;
-#endif
+		cacheMode = ResolveCacheMode(cacheMode);
+		this->cacheMode = cacheMode;
+
+		if (!IsCacheModeSupported(cacheMode))
+		{
+			throw Exception("cached ION mapping needs user space cache maintenance");
+		}
+
+		if (cacheMode == IonCacheMode::Cached)
+		{
+			allocation_data.flags = ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC;
+		}
+		else
+		{
+			allocation_data.flags = 0;
+		}
 
 		io = ioctl(ion_fd, ION_IOC_ALLOC, &allocation_data);
 		if (io != 0)
@@ -105,8 +179,6 @@ public:
 			throw Exception("ION_IOC_ALLOC failed.");
 		}
 
-		fprintf(stderr, "ion handle=%d\n", allocation_data.handle);
-
 
 		// Map/share the buffer
 		ion_fd_data ionData = { 0 };
@@ -115,11 +187,10 @@ public:
 		io = ioctl(ion_fd, ION_IOC_SHARE, &ionData);
 		if (io != 0)
 		{
+			Free(allocation_data.handle);
 			throw Exception("ION_IOC_SHARE failed.");
 		}
 
-		fprintf(stderr, "ion map=%d\n", ionData.fd);
-
 
 		// Get the physical address for the buffer
 		meson_phys_data physData = { 0 };
@@ -132,6 +203,8 @@ public:
 		io = ioctl(ion_fd, ION_IOC_CUSTOM, &ionCustomData);
 		if (io != 0)
 		{
+			close(ionData.fd);
+			Free(allocation_data.handle);
 			throw Exception("ION_IOC_CUSTOM failed.");
 		}
 
@@ -141,27 +214,50 @@ public:
 		exportHandle = ionData.fd;
 		length = allocation_data.len;
 		physicalAddress = physData.phys_addr;
-
-		fprintf(stderr, "ion phys_addr=%lu\n", physicalAddress);
 	}
 
-	virtual ~IonBuffer()
+	// A buffer owns its handle and export fd, so it can be moved but not
+	// copied. A moved-from buffer is empty.
+	IonBuffer(const IonBuffer&) = delete;
+	IonBuffer& operator=(const IonBuffer&) = delete;
+
+	IonBuffer(IonBuffer&& other)
+		: bufferSize(other.bufferSize), cacheMode(other.cacheMode), handle(other.handle),
+		exportHandle(other.exportHandle), length(other.length), physicalAddress(other.physicalAddress)
 	{
-		ion_handle_data ionHandleData = { 0 };
-		ionHandleData.handle = handle;
+		other.Forget();
+	}
 
-		int io = ioctl(ion_fd, ION_IOC_FREE, &ionHandleData);
-		if (io != 0)
+	IonBuffer& operator=(IonBuffer&& other)
+	{
+		if (this != &other)
 		{
-			throw Exception("ION_IOC_FREE failed.");
+			Release();
+
+			bufferSize = other.bufferSize;
+			cacheMode = other.cacheMode;
+			handle = other.handle;
+			exportHandle = other.exportHandle;
+			length = other.length;
+			physicalAddress = other.physicalAddress;
+
+			other.Forget();
 		}
+
+		return *this;
+	}
+
+	virtual ~IonBuffer()
+	{
+		Release();
 	}
 
 
 	void Sync()
 	{
+		if (cacheMode != IonCacheMode::Cached)
+			return;
 
-#if defined(__aarch64__)
 		ion_fd_data ionFdData = { 0 };
 		ionFdData.fd = ExportHandle();
 
@@ -170,12 +266,135 @@ public:
 		{
 			throw Exception("ION_IOC_SYNC failed.");
 		}
+	}
+
+	// Discards the cached lines of a range of the mapping so the CPU reads
+	// what a device wrote there. The CPU must not have written the range.
+	// Cached buffers only exist where this can be done by address.
+	void InvalidateRange(void* address, size_t count)
+	{
+		if (cacheMode != IonCacheMode::Cached || count == 0)
+			return;
+
+#if defined(__aarch64__)
+		// EL0 may clean and invalidate by address (SCTLR_EL1.UCI). Lines
+		// that are not dirty are only invalidated.
+		uint64_t ctr;
+		asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+		uintptr_t line = 4u << ((ctr >> 16) & 0xf);
+
+		uintptr_t start = (uintptr_t)address & ~(line - 1);
+		uintptr_t end = (uintptr_t)address + count;
+
+		for (uintptr_t p = start; p < end; p += line)
+		{
+			asm volatile("dc civac, %0" : : "r"(p) : "memory");
+		}
+
+		asm volatile("dsb sy" : : : "memory");
+#endif
+	}
+
+	// Cached needs cache maintenance by address from user space (aarch64).
+	// Elsewhere the only way is ION_IOC_SYNC on the whole handle, which is
+	// a shared pool slab, so every pooled buffer would be flushed each frame.
+	static bool IsCacheModeSupported(IonCacheMode mode)
+	{
+#if defined(__aarch64__)
+		return true;
+#else
+		return mode != IonCacheMode::Cached;
 #endif
+	}
+
+	// The mode Default stands for on this platform
+	static IonCacheMode ResolveCacheMode(IonCacheMode mode)
+	{
+		if (mode != IonCacheMode::Default)
+			return mode;
+
+#if defined(__aarch64__)
+		return IonCacheMode::Cached;
+#else
+		return IonCacheMode::WriteCombine;
+#endif
+	}
+
+	static const char* CacheModeName(IonCacheMode mode)
+	{
+		switch (mode)
+		{
+			case IonCacheMode::Cached:
+				return "cached";
 
+			case IonCacheMode::WriteCombine:
+				return "wc";
+
+			case IonCacheMode::Uncached:
+				return "uncached";
+
+			default:
+				return "default";
+		}
+	}
+
+	// Physical address of a dma-buf exported by another driver, or 0
+	// when it is not backed by contiguous ION memory.
+	static unsigned long QueryPhysicalAddress(int shareFd)
+	{
+		if (ion_fd < 0)
+		{
+			ion_fd = open("/dev/ion", O_RDWR);
+			if (ion_fd < 0)
+			{
+				return 0;
+			}
+		}
+
+		meson_phys_data physData = { 0 };
+		physData.handle = shareFd;
+
+		ion_custom_data ionCustomData = { 0 };
+		ionCustomData.cmd = ION_IOC_MESON_PHYS_ADDR;
+		ionCustomData.arg = (long unsigned int)&physData;
+
+		int io = ioctl(ion_fd, ION_IOC_CUSTOM, &ionCustomData);
+		if (io != 0)
+		{
+			return 0;
+		}
+
+		return physData.phys_addr;
 	}
 
 	void* Map()
 	{
+		if (cacheMode == IonCacheMode::Uncached)
+		{
+			// ION maps uncached buffers write-combined; /dev/mem with
+			// O_SYNC gives a strongly ordered mapping instead.
+			int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+			if (mem_fd >= 0)
+			{
+				void* result = mmap(NULL,
+					Length(),
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED,
+					mem_fd,
+					physicalAddress);
+
+				close(mem_fd);
+
+				if (result != MAP_FAILED)
+				{
+					return result;
+				}
+			}
+
+			fprintf(stderr, "ion: /dev/mem mapping failed, using write-combine.\n");
+			cacheMode = IonCacheMode::WriteCombine;
+		}
+
 		void* result = mmap(NULL,
 			Length(),
 			PROT_READ | PROT_WRITE,
@@ -0,0 +1,284 @@
+#include "IonPool.h"
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "Exception.h"
+#include "Timing.h"
+
+
+IonBlock::IonBlock(IonBlock&& other)
+	: pool(other.pool), slab(other.slab), offset(other.offset), length(other.length), data(other.data)
+{
+	other.pool = nullptr;
+	other.slab = nullptr;
+	other.data = nullptr;
+}
+
+IonBlock& IonBlock::operator=(IonBlock&& other)
+{
+	if (this != &other)
+	{
+		Release();
+
+		pool = other.pool;
+		slab = other.slab;
+		offset = other.offset;
+		length = other.length;
+		data = other.data;
+
+		other.pool = nullptr;
+		other.slab = nullptr;
+		other.data = nullptr;
+	}
+
+	return *this;
+}
+
+void IonBlock::Release()
+{
+	if (pool)
+	{
+		pool->Release(*this);
+	}
+
+	pool = nullptr;
+	slab = nullptr;
+	offset = 0;
+	length = 0;
+	data = nullptr;
+}
+
+
+static size_t PageAlign(size_t length)
+{
+	return (length + IonPool::BLOCK_ALIGNMENT - 1) & ~(IonPool::BLOCK_ALIGNMENT - 1);
+}
+
+
+IonPool& IonPool::Instance()
+{
+	static IonPool instance;
+	return instance;
+}
+
+
+IonPool::IonPool(size_t slabSize)
+	: slabSize(slabSize), allocationTime(256)
+{
+}
+
+IonPool::~IonPool()
+{
+	if (blocksInUse > 0)
+	{
+		fprintf(stderr, "ion pool: %d blocks still in use.\n", blocksInUse);
+	}
+
+	for (Slab* slab : slabs)
+	{
+		munmap(slab->Data, slab->Buffer->Length());
+		delete slab->Buffer;
+		delete slab;
+	}
+}
+
+
+IonPool::Slab* IonPool::CreateSlab(size_t length, IonCacheMode mode)
+{
+	// A full slab when the carveout has room, otherwise just the block
+	IonBuffer* buffer = nullptr;
+
+	if (length < slabSize)
+	{
+		try
+		{
+			buffer = new IonBuffer(slabSize, mode);
+		}
+		catch (Exception&)
+		{
+			fprintf(stderr, "ion pool: no room for a %zu KB slab, allocating %zu KB.\n",
+				slabSize / 1024, length / 1024);
+		}
+	}
+
+	if (buffer == nullptr)
+	{
+		buffer = new IonBuffer(length, mode);
+	}
+
+	unsigned char* data;
+	try
+	{
+		data = (unsigned char*)buffer->Map();
+	}
+	catch (Exception&)
+	{
+		delete buffer;
+		throw;
+	}
+
+	Slab* slab = new Slab();
+	slab->Buffer = buffer;
+	slab->Mode = mode;
+	slab->Data = data;
+	slab->Free.push_back(FreeRange { 0, buffer->Length() });
+	slab->HighWater = 0;
+
+	slabs.push_back(slab);
+
+	return slab;
+}
+
+
+IonBlock IonPool::Allocate(size_t length, IonCacheMode cacheMode)
+{
+	if (length < 1)
+		throw Exception("length < 1");
+
+	double start = GetTime();
+
+	size_t blockLength = PageAlign(length);
+	IonCacheMode mode = IonBuffer::ResolveCacheMode(cacheMode);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Slab* owner = nullptr;
+	size_t index = 0;
+
+	// The first free range that fits
+	for (Slab* slab : slabs)
+	{
+		if (slab->Mode != mode)
+			continue;
+
+		for (size_t i = 0; i < slab->Free.size(); ++i)
+		{
+			if (slab->Free[i].Length >= blockLength)
+			{
+				owner = slab;
+				index = i;
+				break;
+			}
+		}
+
+		if (owner)
+			break;
+	}
+
+	if (owner == nullptr)
+	{
+		owner = CreateSlab(blockLength, mode);
+		index = 0;
+	}
+
+	FreeRange& range = owner->Free[index];
+	size_t offset = range.Offset;
+
+	range.Offset += blockLength;
+	range.Length -= blockLength;
+	if (range.Length == 0)
+	{
+		owner->Free.erase(owner->Free.begin() + index);
+	}
+
+	if (offset < owner->HighWater)
+	{
+		++recycled;
+	}
+
+	if (offset + blockLength > owner->HighWater)
+	{
+		owner->HighWater = offset + blockLength;
+	}
+
+
+	IonBlock result;
+	result.pool = this;
+	result.slab = owner->Buffer;
+	result.offset = offset;
+	result.length = blockLength;
+	result.data = owner->Data + offset;
+
+	bytesInUse += blockLength;
+	if (bytesInUse > peakInUse)
+		peakInUse = bytesInUse;
+
+	++blocksInUse;
+	++allocations;
+
+	allocationTime.Add(GetTime() - start);
+
+	return result;
+}
+
+void IonPool::Release(IonBlock& block)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (Slab* slab : slabs)
+	{
+		if (slab->Buffer != block.slab)
+			continue;
+
+		std::vector<FreeRange>& free = slab->Free;
+
+		size_t i = 0;
+		while (i < free.size() && free[i].Offset < block.offset)
+		{
+			++i;
+		}
+
+		// Merge with the range after the block, then the one before it
+		FreeRange entry { block.offset, block.length };
+
+		if (i < free.size() && entry.Offset + entry.Length == free[i].Offset)
+		{
+			entry.Length += free[i].Length;
+			free.erase(free.begin() + i);
+		}
+
+		if (i > 0 && free[i - 1].Offset + free[i - 1].Length == entry.Offset)
+		{
+			free[i - 1].Length += entry.Length;
+		}
+		else
+		{
+			free.insert(free.begin() + i, entry);
+		}
+
+		break;
+	}
+
+	bytesInUse -= block.length;
+	--blocksInUse;
+}
+
+
+size_t IonPool::SlabCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return slabs.size();
+}
+
+void IonPool::PrintStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	size_t total = 0;
+	for (Slab* slab : slabs)
+	{
+		total += slab->Buffer->Length();
+	}
+
+	printf("ion pool: slabs=%zu (%.1f MB) in use=%.1f MB (%.0f%%) peak=%.1f MB blocks=%d allocations=%llu recycled=%llu\n",
+		slabs.size(), total / 1048576.0, bytesInUse / 1048576.0,
+		total ? 100.0 * bytesInUse / total : 0.0, peakInUse / 1048576.0,
+		blocksInUse, allocations, recycled);
+
+	if (allocationTime.Count() > 0)
+	{
+		printf("ion pool: allocation latency (ms) mean=%.3f max=%.3f\n",
+			allocationTime.Mean() * 1000.0, allocationTime.Max() * 1000.0);
+	}
+}
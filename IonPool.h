@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+#include "IonBuffer.h"
+#include "Statistics.h"
+
+
+class IonPool;
+
+
+// A block of physically contiguous memory carved out of a pooled ION
+// slab. It can be moved but not copied; destroying it returns the block
+// to its pool.
+class IonBlock
+{
+	friend class IonPool;
+
+	IonPool* pool = nullptr;
+	IonBuffer* slab = nullptr;
+	size_t offset = 0;
+	size_t length = 0;
+	unsigned char* data = nullptr;
+
+
+public:
+
+	bool IsValid() const
+	{
+		return pool != nullptr;
+	}
+
+	// What was asked for, rounded up to whole pages
+	size_t Length() const
+	{
+		return length;
+	}
+
+	unsigned char* Data() const
+	{
+		return data;
+	}
+
+	unsigned long PhysicalAddress() const
+	{
+		return slab ? slab->PhysicalAddress() + offset : 0;
+	}
+
+	IonCacheMode CacheMode() const
+	{
+		return slab ? slab->CacheMode() : IonCacheMode::Default;
+	}
+
+
+	IonBlock()
+	{
+	}
+
+	IonBlock(const IonBlock&) = delete;
+	IonBlock& operator=(const IonBlock&) = delete;
+
+	IonBlock(IonBlock&& other);
+	IonBlock& operator=(IonBlock&& other);
+
+	~IonBlock()
+	{
+		Release();
+	}
+
+
+	void Release();
+
+	// See IonBuffer::InvalidateRange
+	void InvalidateRange(void* address, size_t count)
+	{
+		if (slab)
+			slab->InvalidateRange(address, count);
+	}
+};
+
+
+// Hands out blocks of a few large ION carveout slabs so that starting or
+// reconfiguring the mirrors does not cost an ION allocation per buffer.
+// Blocks are rounded up to whole pages and carved first fit from the free
+// ranges of a slab with the same cache mode. Released blocks are merged
+// with their free neighbours, so a slab whose blocks are all released is
+// one free range again; slabs are only returned to ION when the pool goes
+// away.
+class IonPool
+{
+	friend class IonBlock;
+
+	struct FreeRange
+	{
+		size_t Offset;
+		size_t Length;
+	};
+
+	struct Slab
+	{
+		IonBuffer* Buffer;
+		IonCacheMode Mode;
+		unsigned char* Data;
+
+		// Sorted by offset, never adjacent to each other
+		std::vector<FreeRange> Free;
+
+		// Everything below has been handed out before
+		size_t HighWater;
+	};
+
+
+	mutable std::mutex mutex;
+	size_t slabSize;
+	std::vector<Slab*> slabs;
+
+	size_t bytesInUse = 0;
+	size_t peakInUse = 0;
+	int blocksInUse = 0;
+	unsigned long long allocations = 0;
+	unsigned long long recycled = 0;
+	Statistics allocationTime;
+
+
+	Slab* CreateSlab(size_t length, IonCacheMode mode);
+	void Release(IonBlock& block);
+
+
+public:
+
+	// Large enough for the stacked buffers of a few 480x320 sinks
+	static const size_t DEFAULT_SLAB_SIZE = 8 * 1024 * 1024;
+
+	// Block granularity; keeps every block page aligned
+	static const size_t BLOCK_ALIGNMENT = 4096;
+
+
+	// The pool shared by all converters
+	static IonPool& Instance();
+
+
+	IonPool(size_t slabSize = DEFAULT_SLAB_SIZE);
+	~IonPool();
+
+	IonPool(const IonPool&) = delete;
+	IonPool& operator=(const IonPool&) = delete;
+
+
+	// Throws when ION cannot provide the memory
+	IonBlock Allocate(size_t length, IonCacheMode cacheMode = IonCacheMode::Default);
+
+	size_t SlabCount() const;
+
+	// Occupancy and allocation latency
+	void PrintStats() const;
+};
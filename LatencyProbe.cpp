@@ -0,0 +1,181 @@
+#include "LatencyProbe.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include "Exception.h"
+
+
+// Seconds per step of the encoded time; the code wraps after 6.5 s
+const double TICK = 0.0001;
+
+
+LatencyProbe::LatencyProbe(FrameBuffer& source, const Mirror& mirror, size_t window)
+	: source(source), mirror(mirror), outputLatency(window), sinkLatency(window)
+{
+	if (&mirror.Source() != &source)
+		throw Exception("mirror of another source");
+
+	Rectangle rect = mirror.MirroredRect();
+	const Rectangle& destination = mirror.Destination();
+
+	// Enough source pixels per cell for four output pixels, so the
+	// sampled center is clear of any filtering at the cell edges
+	double scale = fmax((double)rect.Width / destination.Width, (double)rect.Height / destination.Height);
+	cellSize = (int)ceil(scale * 4);
+	if (cellSize < 4)
+		cellSize = 4;
+
+	originX = rect.X;
+	originY = rect.Y;
+
+	if (BITS * cellSize > rect.Width || 2 * cellSize > rect.Height)
+	{
+		printf("probe: %s: the mirrored region is too small for a marker\n", mirror.Sink().DeviceName().c_str());
+		return;
+	}
+
+	for (int row = 0; row < 2; ++row)
+	{
+		for (int column = 0; column < BITS; ++column)
+		{
+			int x;
+			int y;
+			if (!mirror.MapSourcePoint(originX + column * cellSize + cellSize / 2,
+				originY + row * cellSize + cellSize / 2, &x, &y))
+			{
+				return;
+			}
+
+			cellX.push_back(x);
+			cellY.push_back(y);
+		}
+	}
+
+	valid = true;
+
+	printf("probe: %s: %dx%d marker at %d,%d of %s\n", mirror.Sink().DeviceName().c_str(),
+		BITS * cellSize, 2 * cellSize, originX, originY, source.DeviceName().c_str());
+}
+
+
+unsigned int LatencyProbe::Encode(double time)
+{
+	return (unsigned long long)(time / TICK) & ((1u << BITS) - 1);
+}
+
+double LatencyProbe::Age(unsigned int code, double now)
+{
+	unsigned int ticks = (Encode(now) - code) & ((1u << BITS) - 1);
+	return ticks * TICK;
+}
+
+
+void LatencyProbe::DrawCell(int column, int row, bool white)
+{
+	const PixelFormat& format = source.Format();
+	unsigned int pixel = format.Pack(white ? 0xffffffff : 0xff000000);
+
+	int left = originX + column * cellSize;
+	int top = originY + row * cellSize;
+
+	for (int y = top; y < top + cellSize; ++y)
+	{
+		unsigned char* line = (unsigned char*)source.Data() + (size_t)y * source.Stride();
+
+		for (int x = left; x < left + cellSize; ++x)
+		{
+			format.Store(line + x * format.BytesPerPixel(), pixel);
+		}
+	}
+}
+
+void LatencyProbe::Inject(double now)
+{
+	if (!valid)
+		return;
+
+	unsigned int code = Encode(now);
+
+	for (int column = 0; column < BITS; ++column)
+	{
+		bool bit = (code >> (BITS - 1 - column)) & 1;
+
+		DrawCell(column, 0, bit);
+		DrawCell(column, 1, !bit);
+	}
+
+	++injected;
+}
+
+
+int LatencyProbe::Decode(const unsigned char* data, int stride, const PixelFormat& format) const
+{
+	const int BLACK = 96;
+	const int WHITE = 160;
+
+	unsigned int code = 0;
+
+	for (int column = 0; column < BITS; ++column)
+	{
+		int levels[2];
+
+		for (int row = 0; row < 2; ++row)
+		{
+			int index = row * BITS + column;
+			const unsigned char* pixel = data + (size_t)cellY[index] * stride + cellX[index] * format.BytesPerPixel();
+
+			// Green has the most bits in every format
+			levels[row] = (format.Unpack(format.Load(pixel)) >> 8) & 0xff;
+		}
+
+		// Each cell has to be clearly white over black or the reverse
+		bool one = levels[0] > WHITE && levels[1] < BLACK;
+		bool zero = levels[0] < BLACK && levels[1] > WHITE;
+
+		if (!one && !zero)
+			return -1;
+
+		code = (code << 1) | (one ? 1 : 0);
+	}
+
+	return code;
+}
+
+void LatencyProbe::Sample(double now)
+{
+	if (!valid)
+		return;
+
+	const FrameBuffer& sink = mirror.Sink();
+	const PixelFormat& format = sink.Format();
+
+
+	// The newest marker in any converted buffer
+	const Converter& converter = mirror.GetConverter();
+	int stride = sink.Width() * format.BytesPerPixel();
+
+	int newest = -1;
+	for (int i = 0; i < converter.BufferCount(); ++i)
+	{
+		int code = Decode((const unsigned char*)converter.Output(i), stride, format);
+
+		if (code >= 0 && (newest < 0 || Age(code, now) < Age(newest, now)))
+			newest = code;
+	}
+
+	if (newest >= 0 && newest != lastOutputCode)
+	{
+		outputLatency.Add(Age(newest, now));
+		lastOutputCode = newest;
+	}
+
+
+	int code = Decode((const unsigned char*)sink.Data(), sink.Stride(), format);
+
+	if (code >= 0 && code != lastSinkCode)
+	{
+		sinkLatency.Add(Age(code, now));
+		lastSinkCode = code;
+	}
+}
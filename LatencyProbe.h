@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include "FrameBuffer.h"
+#include "Mirror.h"
+#include "Statistics.h"
+
+
+// Measures how old the image on a sink is. Before each frame a marker
+// encoding the current time is drawn into the top left corner of the
+// mirrored region of the source. After the frame the converted buffers
+// and the sink are searched for it, and the age of the newest marker
+// found is recorded the first time it shows up.
+//
+// The marker is two rows of BITS cells: the time in 100 us units, modulo
+// 2^BITS, as white and black cells, and its complement below. A cell is
+// large enough to cover several output pixels after scaling.
+class LatencyProbe
+{
+	static const int BITS = 16;
+
+	FrameBuffer& source;
+	const Mirror& mirror;
+
+	bool valid = false;
+	int originX = 0;
+	int originY = 0;
+	int cellSize = 0;
+
+	// Output position of the center of each cell, code row first
+	std::vector<int> cellX;
+	std::vector<int> cellY;
+
+	int lastOutputCode = -1;
+	int lastSinkCode = -1;
+
+	unsigned long long injected = 0;
+	Statistics outputLatency;
+	Statistics sinkLatency;
+
+
+	static unsigned int Encode(double time);
+	static double Age(unsigned int code, double now);
+
+	// The code in an image with the output geometry, or -1
+	int Decode(const unsigned char* data, int stride, const PixelFormat& format) const;
+
+	void DrawCell(int column, int row, bool white);
+
+
+public:
+
+	bool IsValid() const
+	{
+		return valid;
+	}
+
+	unsigned long long Injected() const
+	{
+		return injected;
+	}
+
+	// Marker drawn to marker first seen in a converted buffer
+	const Statistics& OutputLatency() const
+	{
+		return outputLatency;
+	}
+
+	// Marker drawn to marker first seen in the sink memory
+	const Statistics& SinkLatency() const
+	{
+		return sinkLatency;
+	}
+
+
+	// The mirror must mirror source. Markers are not drawn when the
+	// mirrored region is too small to hold one.
+	LatencyProbe(FrameBuffer& source, const Mirror& mirror, size_t window);
+
+
+	// Draws the marker for time now into the source
+	void Inject(double now);
+
+	// Looks for a new marker in the outputs and the sink
+	void Sample(double now);
+};
@@ -0,0 +1,78 @@
+#include "MappedFrameBuffer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "Exception.h"
+
+
+MappedFrameBuffer::MappedFrameBuffer(MappedFrameBufferType type, const char* name,
+	int width, int height, const PixelFormat& format,
+	double refreshRate)
+	: FrameBuffer(name), vsyncTimer(refreshRate)
+{
+	this->width = width;
+	this->height = height;
+	this->bpp = format.BitsPerPixel;
+	this->format = format;
+	length = width * height * format.BytesPerPixel();
+
+
+	switch (type)
+	{
+		case MappedFrameBufferType::File:
+			fd = open(name, O_RDWR | O_CREAT, 0644);
+			break;
+
+		case MappedFrameBufferType::SharedMemory:
+		{
+			std::string shmName = (name[0] == '/') ? name : std::string("/") + name;
+			fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT, 0644);
+		}
+		break;
+
+		default:
+			fd = syscall(SYS_memfd_create, name, 0);
+			break;
+	}
+
+	if (fd < 0)
+	{
+		throw Exception("open failed.");
+	}
+
+
+	// Grow (never shrink) the backing store to hold a frame
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		throw Exception("fstat failed.");
+	}
+
+	if (st.st_size < length && ftruncate(fd, length) != 0)
+	{
+		throw Exception("ftruncate failed.");
+	}
+
+
+	data = mmap(0, length, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		throw Exception("mmap failed");
+	}
+}
+
+MappedFrameBuffer::~MappedFrameBuffer()
+{
+	munmap(data, length);
+	close(fd);
+}
+
+
+void MappedFrameBuffer::WaitForVSync()
+{
+	vsyncTimer.Wait();
+}
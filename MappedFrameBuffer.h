@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FrameBuffer.h"
+#include "VSyncTimer.h"
+
+
+enum class MappedFrameBufferType
+{
+	File = 0,
+	SharedMemory,
+	Anonymous
+};
+
+
+// A framebuffer stand-in backed by a file, POSIX shared memory or a memfd.
+// Other processes can render into the file and shared memory variants.
+class MappedFrameBuffer : public FrameBuffer
+{
+	int fd;
+	VSyncTimer vsyncTimer;
+
+
+public:
+
+	int FileDescriptor() const
+	{
+		return fd;
+	}
+
+
+	MappedFrameBuffer(MappedFrameBufferType type, const char* name,
+		int width, int height, const PixelFormat& format,
+		double refreshRate);
+	virtual ~MappedFrameBuffer();
+
+
+	virtual void WaitForVSync() override;
+};
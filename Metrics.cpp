@@ -0,0 +1,68 @@
+#include "Metrics.h"
+
+#include <stdio.h>
+
+
+// From well inside a 60 Hz frame to a stall of a second
+const double Histogram::BOUNDS[BUCKET_COUNT] =
+{
+	0.0005, 0.001, 0.002, 0.004, 0.008, 0.012, 0.017, 0.025, 0.033, 0.05, 0.1, 1.0
+};
+
+
+Histogram::Histogram()
+	: sumNanoseconds(0)
+{
+	for (auto& bucket : buckets)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+
+void Histogram::Observe(double seconds)
+{
+	if (seconds < 0)
+		seconds = 0;
+
+	int index = 0;
+	while (index < BUCKET_COUNT && seconds > BOUNDS[index])
+	{
+		++index;
+	}
+
+	buckets[index].fetch_add(1, std::memory_order_relaxed);
+	sumNanoseconds.fetch_add((unsigned long long)(seconds * 1e9), std::memory_order_relaxed);
+}
+
+void Histogram::Write(std::string& out, const char* name, const std::string& labels) const
+{
+	const char* separator = labels.empty() ? "" : ",";
+	char line[256];
+
+	unsigned long long count = 0;
+	for (int i = 0; i <= BUCKET_COUNT; ++i)
+	{
+		count += buckets[i].load(std::memory_order_relaxed);
+
+		if (i < BUCKET_COUNT)
+		{
+			snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %llu\n",
+				name, labels.c_str(), separator, BOUNDS[i], count);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+				name, labels.c_str(), separator, count);
+		}
+
+		out += line;
+	}
+
+	snprintf(line, sizeof(line), "%s_sum{%s} %.9f\n", name, labels.c_str(),
+		sumNanoseconds.load(std::memory_order_relaxed) / 1e9);
+	out += line;
+
+	snprintf(line, sizeof(line), "%s_count{%s} %llu\n", name, labels.c_str(), count);
+	out += line;
+}
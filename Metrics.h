@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+
+// Durations counted into fixed buckets, as a Prometheus histogram.
+// Observe is lock-free, so the pipeline threads can record while the
+// main thread writes the histogram out.
+class Histogram
+{
+public:
+
+	static const int BUCKET_COUNT = 12;
+
+	// Upper bounds of the buckets in seconds; one more counts the rest
+	static const double BOUNDS[BUCKET_COUNT];
+
+
+private:
+
+	std::atomic<unsigned long long> buckets[BUCKET_COUNT + 1];
+	std::atomic<unsigned long long> sumNanoseconds;
+
+
+public:
+
+	Histogram();
+
+
+	void Observe(double seconds);
+
+	// Appends the _bucket, _sum and _count lines of one series. labels
+	// is empty or a list such as sink="/dev/fb2",stage="copy".
+	void Write(std::string& out, const char* name, const std::string& labels) const;
+};
+
+
+// What the metrics endpoint reports about one mirror. Each field is
+// updated in place by the thread that measures it.
+struct MirrorMetrics
+{
+	Histogram VSync;
+	Histogram Wait;
+	Histogram Convert;
+	Histogram Copy;
+	Histogram Frame;
+	Histogram Latency;
+
+	std::atomic<unsigned long long> BytesWritten;
+
+
+	MirrorMetrics()
+		: BytesWritten(0)
+	{
+	}
+};
@@ -0,0 +1,209 @@
+#include "MetricsServer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Exception.h"
+
+
+static std::string LabelValue(const std::string& value)
+{
+	std::string result;
+
+	for (char c : value)
+	{
+		if (c == '\\' || c == '"')
+			result += '\\';
+
+		result += c;
+	}
+
+	return result;
+}
+
+static void Family(std::string& out, const char* name, const char* type, const char* help)
+{
+	out += "# HELP ";
+	out += name;
+	out += " ";
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += " ";
+	out += type;
+	out += "\n";
+}
+
+static void Sample(std::string& out, const char* name, const std::string& labels, double value)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%s{%s} %.17g\n", name, labels.c_str(), value);
+
+	out += line;
+}
+
+
+MetricsServer::MetricsServer(MirrorGroup& group, const char* path)
+	: group(group)
+{
+	sockaddr_un address = { 0 };
+	address.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+		throw Exception("metrics socket path too long");
+
+	strcpy(address.sun_path, path);
+
+	socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (socketFd < 0)
+	{
+		throw Exception("socket failed.");
+	}
+
+	// A socket left behind by a previous run
+	unlink(path);
+
+	if (bind(socketFd, (sockaddr*)&address, sizeof(address)) < 0 || listen(socketFd, 4) < 0)
+	{
+		close(socketFd);
+		throw Exception("bind metrics socket failed.");
+	}
+
+	socketPath = path;
+
+	printf("metrics: %s\n", path);
+}
+
+MetricsServer::~MetricsServer()
+{
+	close(socketFd);
+	unlink(socketPath.c_str());
+}
+
+
+std::string MetricsServer::Render()
+{
+	const std::vector<Mirror*>& mirrors = group.Mirrors();
+
+	std::vector<std::string> sinks;
+	for (Mirror* mirror : mirrors)
+	{
+		sinks.push_back("sink=\"" + LabelValue(mirror->Sink().DeviceName()) + "\"");
+	}
+
+	std::string out;
+	out.reserve(16384);
+
+
+	std::string source = "source=\"" + LabelValue(group.Source().DeviceName()) + "\"";
+
+	Family(out, "c2screen2lcd_source_frames_total", "counter", "Source vsyncs waited for.");
+	Sample(out, "c2screen2lcd_source_frames_total", source, group.Frames());
+
+	Family(out, "c2screen2lcd_missed_deadlines_total", "counter",
+		"Deadlines missed: late (sinks not done by the next vsync), vsync (vsyncs the loop slept through).");
+	Sample(out, "c2screen2lcd_missed_deadlines_total", source + ",kind=\"late\"", group.LateFrames());
+	Sample(out, "c2screen2lcd_missed_deadlines_total", source + ",kind=\"vsync\"", group.MissedVSyncs());
+
+	Family(out, "c2screen2lcd_reconfigurations_total", "counter", "Source mode changes handled.");
+	Sample(out, "c2screen2lcd_reconfigurations_total", source, group.Reconfigurations());
+
+
+	Family(out, "c2screen2lcd_frames_total", "counter",
+		"Frames by outcome: produced (converted), presented (copied to the sink), skipped (pacing), dropped (overtaken), idle (unchanged source).");
+
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		const Mirror* mirror = mirrors[i];
+
+		Sample(out, "c2screen2lcd_frames_total", sinks[i] + ",state=\"produced\"", mirror->Produced());
+		Sample(out, "c2screen2lcd_frames_total", sinks[i] + ",state=\"presented\"", mirror->Presented());
+		Sample(out, "c2screen2lcd_frames_total", sinks[i] + ",state=\"skipped\"", mirror->Skipped());
+		Sample(out, "c2screen2lcd_frames_total", sinks[i] + ",state=\"dropped\"", mirror->Dropped());
+		Sample(out, "c2screen2lcd_frames_total", sinks[i] + ",state=\"idle\"", mirror->IdleFrames());
+	}
+
+	Family(out, "c2screen2lcd_idle", "gauge", "1 while conversion is stopped for an unchanged source.");
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		Sample(out, "c2screen2lcd_idle", sinks[i], mirrors[i]->IsIdle() ? 1 : 0);
+	}
+
+	Family(out, "c2screen2lcd_sink_bytes_written_total", "counter", "Bytes written to the sink framebuffer.");
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		Sample(out, "c2screen2lcd_sink_bytes_written_total", sinks[i],
+			mirrors[i]->Metrics().BytesWritten.load(std::memory_order_relaxed));
+	}
+
+	Family(out, "c2screen2lcd_ge2d_errors_total", "counter", "GE2D ioctls that failed.");
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		Sample(out, "c2screen2lcd_ge2d_errors_total", sinks[i], mirrors[i]->ConverterErrors());
+	}
+
+
+	Family(out, "c2screen2lcd_stage_seconds", "histogram",
+		"Time per frame in each stage: vsync wait, wait for the previous conversion, convert (GE2D ioctl or CPU), copy to the sink, whole frame.");
+
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		const MirrorMetrics& metrics = mirrors[i]->Metrics();
+
+		metrics.VSync.Write(out, "c2screen2lcd_stage_seconds", sinks[i] + ",stage=\"vsync\"");
+		metrics.Wait.Write(out, "c2screen2lcd_stage_seconds", sinks[i] + ",stage=\"wait\"");
+		metrics.Convert.Write(out, "c2screen2lcd_stage_seconds", sinks[i] + ",stage=\"convert\"");
+		metrics.Copy.Write(out, "c2screen2lcd_stage_seconds", sinks[i] + ",stage=\"copy\"");
+		metrics.Frame.Write(out, "c2screen2lcd_stage_seconds", sinks[i] + ",stage=\"frame\"");
+	}
+
+	Family(out, "c2screen2lcd_latency_seconds", "histogram", "Source vsync to the end of the copy to the sink.");
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		mirrors[i]->Metrics().Latency.Write(out, "c2screen2lcd_latency_seconds", sinks[i]);
+	}
+
+	return out;
+}
+
+
+void MetricsServer::Accept()
+{
+	while (true)
+	{
+		int client = accept4(socketFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client < 0)
+			break;
+
+		// The request does not matter; read what has arrived so closing
+		// does not reset the connection.
+		char request[1024];
+		while (recv(client, request, sizeof(request), 0) > 0)
+		{
+		}
+
+		std::string body = Render();
+
+		char header[256];
+		snprintf(header, sizeof(header),
+			"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+			body.size());
+
+		std::string response = header + body;
+
+		size_t sent = 0;
+		while (sent < response.size())
+		{
+			ssize_t count = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (count <= 0)
+				break;
+
+			sent += count;
+		}
+
+		close(client);
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "MirrorGroup.h"
+
+
+// Serves the counters and stage histograms of a MirrorGroup in the
+// Prometheus text format on a Unix stream socket. Every connection gets
+// one HTTP/1.0 response and is closed:
+//
+//   curl --unix-socket /run/c2screen2lcd.sock http://localhost/metrics
+//
+// Nothing is computed until a scrape arrives, and a scrape changes no
+// state, so any number of scrapers can share the socket. Rates come from
+// the counters, e.g. the output rate from
+// rate(c2screen2lcd_frames_total{state="presented"}[1m]).
+class MetricsServer
+{
+	MirrorGroup& group;
+	std::string socketPath;
+	int socketFd = -1;
+
+
+	std::string Render();
+
+
+public:
+
+	// Watch this for connections
+	int Fd() const
+	{
+		return socketFd;
+	}
+
+
+	MetricsServer(MirrorGroup& group, const char* path);
+	~MetricsServer();
+
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(const MetricsServer&) = delete;
+
+
+	// Answers the pending connections without blocking the caller for
+	// longer than writing the response takes
+	void Accept();
+};
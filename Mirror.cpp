@@ -0,0 +1,1186 @@
+#include "Mirror.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "FbdevFrameBuffer.h"
+#include "Ge2dConverter.h"
+#include "Timing.h"
+#include "Tracer.h"
+#include "Exception.h"
+
+
+Mirror::Mirror(FrameBuffer& source, FrameBuffer& sink, const MirrorOptions& options)
+	: source(source), sink(sink), options(options),
+	produced(0), presented(0), dropped(0), unchangedPresents(0), sourceRectChanged(false), running(false),
+	latency(options.StatsWindow),
+	vsyncTime(options.StatsWindow), waitTime(options.StatsWindow), convertTime(options.StatsWindow),
+	copyTime(options.StatsWindow), frameTime(options.StatsWindow)
+{
+	state = { 0 };
+
+	double outputRate = options.OutputRate;
+
+	threaded = options.Threaded;
+
+	// The LCD is written in its own format (RGB666 on the ILI9488), so the
+	// panel driver has nothing left to convert.
+	const PixelFormat& sinkFormat = sink.Format();
+	if (!sinkFormat.IsSupported())
+	{
+		throw Exception("Unexpected fb2 pixel format");
+	}
+
+	printf("output format: %s\n", sinkFormat.Name().c_str());
+
+
+	// Rotation is done by the conversion, so the panel driver can run
+	// unrotated. Everything up to the converter works on the logical
+	// (upright) image.
+	transform = ResolveTransform(sink, options);
+
+	printf("rotation: %d%s%s\n", transform.Rotation,
+		transform.FlipX ? " flip-h" : "", transform.FlipY ? " flip-v" : "");
+
+
+	ClearSink();
+
+	if (!options.Overlay.empty())
+	{
+		overlay = FrameBuffer::Create(options.Overlay.c_str(), 60);
+
+		if (overlay->Format() != PixelFormat::Xrgb8888())
+		{
+			delete overlay;
+			throw Exception("overlay must be 32 bpp ARGB");
+		}
+
+		printf("overlay: %s %dx%d\n", overlay->DeviceName().c_str(), overlay->Width(), overlay->Height());
+	}
+
+	sourceRect = options.SourceRect;
+	CreateConverter();
+
+
+	// Time a few serial conversions so the pipelined wait can be
+	// expressed as the fraction of the conversion that was hidden.
+	const int CALIBRATION_FRAMES = 8;
+
+	double serialStart = GetTime();
+	for (int i = 0; i < CALIBRATION_FRAMES; ++i)
+	{
+		converter->Convert(0);
+		converter->Wait();
+	}
+	serialTime = (GetTime() - serialStart) / CALIBRATION_FRAMES;
+
+
+	captureTimes.resize(converter->BufferCount());
+
+
+	// Only the pages that changed are written to the LCD, with the copy
+	// kernel that is fastest on this particular mapping.
+	CopyMethod copyMethod = CopyMethod::Memcpy;
+	if (zeroCopy)
+	{
+		// GE2D writes the LCD itself; no kernel is ever used
+	}
+	else if (options.Copy == "auto")
+	{
+		const int COPY_ITERATIONS = 4;
+
+		// Timed on the path it will run, from a converted output buffer
+		// (ION or heap) into the LCD. That leaves the calibration frame
+		// on the LCD, possibly unaligned to a padded stride until the
+		// first present rewrites it.
+		copyMethod = SelectCopyMethod(sink.Data(), converter->Output(0), converter->OutputLength(), COPY_ITERATIONS);
+	}
+	else
+	{
+		copyMethod = ParseCopyMethod(options.Copy);
+	}
+
+	copy = new DirtyCopy(converter->OutputLength(), copyMethod, sink.Width() * sinkFormat.BytesPerPixel(), sink.Stride());
+
+	if (!zeroCopy)
+		printf("copy kernel: %s\n", CopyMethodName(copyMethod));
+
+
+	// Output pacing; a negative rate selects the panel refresh rate
+	if (outputRate < 0)
+	{
+		outputRate = FramePacer::DetectRefreshRate(sink);
+	}
+
+	pacer = new FramePacer(outputRate);
+
+	if (outputRate > 0)
+		printf("pacing: %.1f fps\n", outputRate);
+	else
+		printf("pacing: off\n");
+
+
+	// Idle detection
+	if (options.Idle)
+	{
+		CreateDetector();
+	}
+
+
+	if (threaded)
+	{
+		Start();
+	}
+}
+
+Mirror::~Mirror()
+{
+	Stop();
+
+	delete freeRing;
+	delete presentRing;
+	delete captureRing;
+
+	DeleteDetector();
+	delete pacer;
+	delete copy;
+	delete converter;
+	delete overlay;
+}
+
+
+void Mirror::ClearSink(unsigned int argb)
+{
+	const PixelFormat& sinkFormat = sink.Format();
+
+	// Clear the LCD display, white unless told otherwise
+	unsigned int color = sinkFormat.Pack(argb);
+
+	for (int y = 0; y < sink.Height(); ++y)
+	{
+		unsigned char* fb2mem = (unsigned char*)sink.Data() + y * sink.Stride();
+
+		for (int x = 0; x < sink.Width(); ++x)
+		{
+			sinkFormat.Store(fb2mem + x * sinkFormat.BytesPerPixel(), color);
+		}
+	}
+}
+
+void Mirror::Blank()
+{
+	// GE2D may still be writing the sink in zero-copy mode
+	converter->Wait();
+
+	ClearSink(0xff000000);
+	sink.Present();
+}
+
+void Mirror::CreateDetector()
+{
+	// Only the visible part of each row; a panned source starts xoffset
+	// pixels into its line, and the padding after it may not be mapped
+	detector = new ChangeDetector(source.Width() * source.Format().BytesPerPixel(), source.Height(), source.Stride());
+
+	if (overlay)
+		overlayDetector = new ChangeDetector(overlay->Width() * overlay->Format().BytesPerPixel(), overlay->Height(), overlay->Stride());
+}
+
+void Mirror::DeleteDetector()
+{
+	delete detector;
+	delete overlayDetector;
+	detector = nullptr;
+	overlayDetector = nullptr;
+}
+
+bool Mirror::SourceChanged()
+{
+	// Both are sampled so that neither falls behind
+	bool changed = detector->HasChanged(source.Data());
+
+	if (overlayDetector && overlayDetector->HasChanged(overlay->Data()))
+		changed = true;
+
+	return changed;
+}
+
+void Mirror::SetSoftwareSource(const void* data)
+{
+	softwareConverter->SetSource(data, source.Stride());
+
+	if (overlay)
+		softwareConverter->SetOverlay(overlay->Data(), overlay->Width(), overlay->Height(), overlay->Stride());
+}
+
+void Mirror::CreateConverter()
+{
+	const PixelFormat& sinkFormat = sink.Format();
+	std::string backend = options.Backend;
+
+	int depth = options.Depth;
+	if (threaded && depth < 3)
+	{
+		// One buffer being converted, one being presented and at least
+		// one queued in between
+		depth = 3;
+	}
+
+
+	// A region must lie inside the source before it decides the letterbox
+	if (sourceRect.Width > 0 &&
+		(sourceRect.X + sourceRect.Width > source.Width() || sourceRect.Y + sourceRect.Height > source.Height()))
+	{
+		printf("roi: outside of fb0, mirroring the whole source\n");
+		sourceRect = { 0, 0, 0, 0 };
+	}
+
+
+	// Aspect ratio
+	Rectangle mirrored = MirroredRect();
+	Rectangle dstRect = CalculateLetterbox(mirrored);
+	destination = dstRect;
+
+	printf("aspect=%f\n", options.Aspect == -1 ? (float)mirrored.Width / (float)mirrored.Height : options.Aspect);
+
+
+	// Conversion backend
+
+	// GE2D reads the OSD0 and OSD1 canvases, so it can only mirror and
+	// composite real framebuffers
+	bool sourceIsDisplay = dynamic_cast<FbdevFrameBuffer*>(&source) != nullptr;
+	bool overlayIsDisplay = overlay == nullptr || dynamic_cast<FbdevFrameBuffer*>(overlay) != nullptr;
+
+	if (backend == "auto")
+	{
+		bool ge2dUsable = sourceIsDisplay && overlayIsDisplay && Ge2dConverter::IsAvailable() &&
+			Ge2dConverter::IsSupported(source.Format()) && Ge2dConverter::IsSupported(sinkFormat);
+
+		backend = (ge2dUsable && IsGe2dTransformAllowed(transform, options)) ? "ge2d" : "cpu";
+
+		if (ge2dUsable && backend == "cpu")
+		{
+			fprintf(stderr, "warning: rotation or flip without --ge2d-rotate, converting on the CPU instead of GE2D\n");
+		}
+	}
+
+	if (backend == "ge2d")
+	{
+		if (!sourceIsDisplay)
+		{
+			throw Exception("ge2d backend requires an fbdev source");
+		}
+
+		if (!overlayIsDisplay)
+		{
+			throw Exception("ge2d backend requires an fbdev overlay");
+		}
+
+		if (!IsGe2dTransformAllowed(transform, options))
+		{
+			throw Exception("ge2d rotation and flips are not verified; use --ge2d-rotate or the cpu backend");
+		}
+
+		unsigned long targetAddress = 0;
+		const char* reason = "disabled";
+
+		if (threaded)
+		{
+			reason = "threaded pipeline";
+		}
+		else if (options.ZeroCopy)
+		{
+			targetAddress = FindZeroCopyTarget(sink, reason);
+		}
+
+		if (targetAddress != 0)
+		{
+			Ge2dConverter* ge2d = new Ge2dConverter(source, sink.Width(), sink.Height(), sinkFormat, dstRect,
+				targetAddress, sink.Data(), transform);
+			converter = ge2d;
+			zeroCopy = true;
+
+			if (overlay)
+				ge2d->SetOverlay(*overlay);
+
+			printf("copy path: zero-copy, GE2D writes fb2 at 0x%lx\n", targetAddress);
+		}
+		else
+		{
+			Ge2dConverter* ge2d = new Ge2dConverter(source, sink.Width(), sink.Height(), sinkFormat, dstRect, depth,
+				ParseIonCacheMode(options.IonCache), transform);
+			converter = ge2d;
+
+			if (overlay)
+				ge2d->SetOverlay(*overlay);
+
+			printf("copy path: %s ION buffer + page copy (zero-copy: %s)\n",
+				IonBuffer::CacheModeName(ge2d->Block().CacheMode()), reason);
+		}
+	}
+	else
+	{
+		softwareConverter = new SoftwareConverter(source.Width(), source.Height(), source.Format(),
+			sink.Width(), sink.Height(), sinkFormat, dstRect,
+			ParseSimdLevel(backend), depth, transform);
+		SetSoftwareSource(source.Data());
+
+		converter = softwareConverter;
+
+		printf("copy path: CPU buffer + page copy\n");
+	}
+
+	printf("converter: %s, depth=%d\n", converter->Name(), converter->BufferCount());
+
+	if (sourceRect.Width > 0)
+	{
+		converter->SetSourceRect(sourceRect);
+	}
+
+	sourceRectChanged = false;
+}
+
+
+void Mirror::Reconfigure()
+{
+	// Nothing may touch the old converter or source mapping from here on
+	Stop();
+
+	delete freeRing;
+	delete presentRing;
+	delete captureRing;
+	freeRing = nullptr;
+	presentRing = nullptr;
+	captureRing = nullptr;
+
+	converter->Wait();
+
+	converterErrors += converter->Errors();
+	delete converter;
+	converter = nullptr;
+	softwareConverter = nullptr;
+	zeroCopy = false;
+
+
+	// The letterbox may have moved
+	ClearSink();
+	copy->Invalidate();
+
+	CreateConverter();
+
+	captureTimes.assign(converter->BufferCount(), 0);
+	current = 0;
+	pending = -1;
+
+	if (detector)
+	{
+		DeleteDetector();
+		CreateDetector();
+	}
+
+	unchangedPresents = 0;
+	if (idle)
+	{
+		Wake(GetTime());
+	}
+
+
+	if (threaded)
+	{
+		Start();
+	}
+}
+
+
+unsigned long Mirror::FindZeroCopyTarget(FrameBuffer& sink, const char*& reason)
+{
+	FbdevFrameBuffer* fb = dynamic_cast<FbdevFrameBuffer*>(&sink);
+	if (fb == nullptr)
+	{
+		reason = "sink is not an fbdev";
+		return 0;
+	}
+
+	if (fb->IsDeferredIo())
+	{
+		reason = "sink uses deferred io";
+		return 0;
+	}
+
+	size_t rowLength = sink.Width() * sink.Format().BytesPerPixel();
+	size_t frameLength = rowLength * sink.Height();
+	if ((size_t)fb->LineLength() != rowLength)
+	{
+		reason = "sink stride is padded";
+		return 0;
+	}
+
+
+	// smem_start of a driver with a contiguous framebuffer
+	if (fb->PhysicalAddress() != 0 && fb->PhysicalLength() >= frameLength)
+	{
+		return fb->PhysicalAddress();
+	}
+
+
+	// A dma-buf export that ION can resolve to a physical address
+	int dmabuf = fb->ExportDmaBuf();
+	if (dmabuf >= 0)
+	{
+		unsigned long address = IonBuffer::QueryPhysicalAddress(dmabuf);
+		close(dmabuf);
+
+		if (address != 0)
+		{
+			return address;
+		}
+	}
+
+	reason = "sink exposes no physical address";
+	return 0;
+}
+
+
+Transform Mirror::ResolveTransform(const FrameBuffer& sink, const MirrorOptions& options)
+{
+	Transform result;
+	result.Rotation = options.Rotation;
+	result.FlipX = options.FlipH;
+	result.FlipY = options.FlipV;
+
+	if (result.Rotation < 0)
+	{
+		result.Rotation = (sink.Height() > sink.Width()) ? 270 : 0;
+	}
+	else if (result.Rotation != 0 && result.Rotation != 90 &&
+		result.Rotation != 180 && result.Rotation != 270)
+	{
+		throw Exception("rotation must be 0, 90, 180 or 270");
+	}
+
+	return result;
+}
+
+bool Mirror::IsGe2dTransformAllowed(const Transform& transform, const MirrorOptions& options)
+{
+	return options.Ge2dRotate || transform.IsIdentity();
+}
+
+Rectangle Mirror::CalculateLetterbox(const Rectangle& rect) const
+{
+	int logicalWidth = transform.SwapsAxes() ? sink.Height() : sink.Width();
+	int logicalHeight = transform.SwapsAxes() ? sink.Width() : sink.Height();
+
+	return CalculateDestination(rect.Width, rect.Height, logicalWidth, logicalHeight, options.Aspect);
+}
+
+Rectangle Mirror::CalculateDestination(int srcWidth, int srcHeight, int dstWidth, int dstHeight, float aspect)
+{
+	const float LCD_ASPECT = (float)dstWidth / (float)dstHeight;	// 3:2 on the 480x320 shield
+
+	// If no aspect ratio was specified, calculate it
+	if (aspect == -1)
+	{
+		aspect = (float)srcWidth / (float)srcHeight;
+	}
+
+	Rectangle result;
+
+	if (aspect == LCD_ASPECT)
+	{
+		result.Width = dstWidth;
+		result.Height = dstHeight;
+		result.X = 0;
+		result.Y = 0;
+	}
+	else if (aspect < LCD_ASPECT)
+	{
+		result.Width = dstHeight * aspect;
+		result.Height = dstHeight;
+		result.X = (dstWidth / 2) - (result.Width / 2);
+		result.Y = 0;
+	}
+	else
+	{
+		result.Width = dstWidth;
+		result.Height = dstWidth * (1.0f / aspect);
+		result.X = 0;
+		result.Y = (dstHeight / 2) - (result.Height / 2);
+	}
+
+	return result;
+}
+
+SimdLevel Mirror::ParseSimdLevel(const std::string& name)
+{
+	if (name == "cpu")
+		return SoftwareConverter::DetectSimd();
+	else if (name == "scalar")
+		return SimdLevel::Scalar;
+	else if (name == "sse2")
+		return SimdLevel::Sse2;
+	else if (name == "avx2")
+		return SimdLevel::Avx2;
+	else if (name == "neon")
+		return SimdLevel::Neon;
+
+	throw Exception("unknown backend");
+}
+
+CopyMethod Mirror::ParseCopyMethod(const std::string& name)
+{
+	CopyMethod result;
+
+	if (name == "memcpy")
+		result = CopyMethod::Memcpy;
+	else if (name == "neon")
+		result = CopyMethod::Neon;
+	else if (name == "stream")
+		result = CopyMethod::Stream;
+	else
+		throw Exception("unknown copy method");
+
+	if (!IsCopySupported(result))
+		throw Exception("copy method not supported");
+
+	return result;
+}
+
+IonCacheMode Mirror::ParseIonCacheMode(const std::string& name)
+{
+	if (name == "default")
+		return IonCacheMode::Default;
+	else if (name == "cached")
+	{
+		if (!IonBuffer::IsCacheModeSupported(IonCacheMode::Cached))
+			throw Exception("ion-cache=cached is only supported on aarch64");
+
+		return IonCacheMode::Cached;
+	}
+	else if (name == "wc")
+		return IonCacheMode::WriteCombine;
+	else if (name == "uncached")
+		return IonCacheMode::Uncached;
+
+	throw Exception("unknown ion cache mode");
+}
+
+
+void Mirror::RunFrame()
+{
+	double start = GetTime();
+
+	// Wait for VSync
+	{
+		TraceScope trace("vsync", source.DeviceName().c_str());
+		source.WaitForVSync();
+	}
+
+	BeginFrame(start, GetTime());
+	EndFrame();
+}
+
+void Mirror::BeginFrame(double start, double vsyncEnd)
+{
+	if (lastVSync > 0)
+	{
+		double interval = vsyncEnd - lastVSync;
+		sourcePeriod = (sourcePeriod == 0) ? interval : sourcePeriod + (interval - sourcePeriod) * 0.1;
+	}
+	lastVSync = vsyncEnd;
+
+	++frames;
+
+	state.Start = start;
+	state.VSyncEnd = vsyncEnd;
+	state.Present = -1;
+	state.Active = false;
+
+	if (threaded)
+	{
+		Capture(start, vsyncEnd);
+		return;
+	}
+
+	state.Due = IsFrameDue(vsyncEnd);
+
+	if (!state.Due && pending < 0)
+	{
+		vsyncTime.Add(vsyncEnd - start);
+		frameTime.Add(vsyncEnd - start);
+		metrics.VSync.Observe(vsyncEnd - start);
+		metrics.Frame.Observe(vsyncEnd - start);
+		return;
+	}
+
+	state.Active = true;
+	state.Begin = GetTime();
+
+
+	// Everything started on the previous frame has finished
+	converter->Wait();
+	state.WaitEnd = GetTime();
+
+	// Color conversion
+	state.Present = pending;
+	pending = -1;
+
+	if (state.Due)
+	{
+		// The data of an image sequence moves every frame, and a panned
+		// fb0 shows another page
+		if (softwareConverter)
+		{
+			SetSoftwareSource(source.Data());
+		}
+
+		converter->SetSourceOffset(source.XOffset(), source.YOffset());
+		ApplySourceRect();
+		converter->Convert(current);
+		captureTimes[current] = vsyncEnd;
+		++produced;
+
+		if (converter->BufferCount() == 1)
+		{
+			state.Present = current;
+		}
+		else if (wakeTime > 0)
+		{
+			// Waking from idle; do not leave the change in the pipeline
+			// for another state. A converted frame still waiting is
+			// replaced by this newer one.
+			converter->Wait();
+
+			if (state.Present >= 0)
+				++dropped;
+
+			state.Present = current;
+			current = (current + 1) % converter->BufferCount();
+		}
+		else
+		{
+			pending = current;
+			current = (current + 1) % converter->BufferCount();
+		}
+	}
+	state.ConvertEnd = GetTime();
+}
+
+void Mirror::EndFrame()
+{
+	if (!state.Active)
+		return;
+
+	int present = state.Present;
+	double convertEnd = GetTime();
+
+	// Copy to LCD
+	size_t written = 0;
+	if (present >= 0)
+	{
+		if (zeroCopy)
+		{
+			// GE2D already wrote the LCD; sample the source instead of
+			// the output to notice a static screen.
+			written = (detector && !SourceChanged()) ? 0 : converter->OutputLength();
+		}
+		else
+		{
+			TraceScope trace("copy", sink.DeviceName().c_str(), present);
+			written = copy->Copy(sink.Data(), converter->Output(present));
+		}
+
+		{
+			TraceScope trace("present", sink.DeviceName().c_str(), present);
+			sink.Present();
+		}
+		++presented;
+	}
+	double copyEnd = GetTime();
+
+	if (present >= 0)
+	{
+		pacer->AddPresentTime(copyEnd - convertEnd);
+		latency.Add(copyEnd - captureTimes[present]);
+		metrics.Latency.Observe(copyEnd - captureTimes[present]);
+
+		if (wakeTime > 0)
+		{
+			wakeLatency.Add(copyEnd - wakeTime);
+			wakeTime = 0;
+		}
+
+		CountPresent(written);
+
+		if (detector && !idle && unchangedPresents >= IDLE_PRESENTS)
+		{
+			EnterIdle(copyEnd);
+		}
+	}
+
+
+	vsyncTime.Add(state.VSyncEnd - state.Start);
+	waitTime.Add(state.WaitEnd - state.Begin);
+	if (state.Due)
+		convertTime.Add(state.ConvertEnd - state.WaitEnd);
+	if (present >= 0)
+		copyTime.Add(copyEnd - convertEnd);
+	frameTime.Add(copyEnd - state.Start);
+
+	metrics.VSync.Observe(state.VSyncEnd - state.Start);
+	metrics.Wait.Observe(state.WaitEnd - state.Begin);
+	if (state.Due)
+		metrics.Convert.Observe(state.ConvertEnd - state.WaitEnd);
+	if (present >= 0)
+		metrics.Copy.Observe(copyEnd - convertEnd);
+	metrics.Frame.Observe(copyEnd - state.Start);
+}
+
+void Mirror::SetSourceRect(const Rectangle& rect)
+{
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		sourceRect = rect;
+	}
+
+	// A region of another shape is letterboxed differently, which the
+	// converters only take at construction. A pixel of rounding is not
+	// worth rebuilding for.
+	if (options.Aspect == -1)
+	{
+		Rectangle letterbox = CalculateLetterbox(MirroredRect());
+
+		if (abs(letterbox.X - destination.X) > 1 || abs(letterbox.Y - destination.Y) > 1 ||
+			abs(letterbox.Width - destination.Width) > 1 || abs(letterbox.Height - destination.Height) > 1)
+		{
+			Reconfigure();
+			return;
+		}
+	}
+
+	sourceRectChanged = true;
+
+	// The LCD has to show the new region even if fb0 is static
+	if (idle)
+	{
+		Wake(GetTime());
+	}
+}
+
+Rectangle Mirror::MirroredRect() const
+{
+	Rectangle rect;
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		rect = sourceRect;
+	}
+
+	if (rect.Width < 1 || rect.Height < 1)
+	{
+		rect.X = 0;
+		rect.Y = 0;
+		rect.Width = source.Width();
+		rect.Height = source.Height();
+	}
+
+	return rect;
+}
+
+bool Mirror::MapSourcePoint(int x, int y, int* outputX, int* outputY) const
+{
+	Rectangle rect = MirroredRect();
+
+	if (x < rect.X || y < rect.Y || x >= rect.X + rect.Width || y >= rect.Y + rect.Height)
+		return false;
+
+	Rectangle point;
+	point.X = destination.X + (int)((x - rect.X + 0.5) * destination.Width / rect.Width);
+	point.Y = destination.Y + (int)((y - rect.Y + 0.5) * destination.Height / rect.Height);
+	point.Width = 1;
+	point.Height = 1;
+
+	Rectangle result = transform.Map(point, sink.Width(), sink.Height());
+
+	*outputX = result.X;
+	*outputY = result.Y;
+
+	return true;
+}
+
+void Mirror::ApplySourceRect()
+{
+	if (!sourceRectChanged.exchange(false))
+		return;
+
+	Rectangle rect;
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		rect = sourceRect;
+	}
+
+	converter->SetSourceRect(rect);
+}
+
+
+bool Mirror::IsFrameDue(double now)
+{
+	if (!idle)
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+
+		bool due = pacer->IsDue(now, sourcePeriod);
+		if (!due)
+		{
+			++skipped;
+		}
+
+		return due;
+	}
+
+
+	// Only look at the source. Every frame is checked so that a change is
+	// presented in the frame it is first visible in.
+	if (SourceChanged())
+	{
+		Wake(lastUnchanged);
+		return true;
+	}
+
+	lastUnchanged = now;
+
+	++idleFrames;
+
+	return false;
+}
+
+void Mirror::CountPresent(size_t written)
+{
+	// A run of frames that changed nothing on the LCD means the source
+	// is static.
+	if (written == 0)
+		++unchangedPresents;
+	else
+		unchangedPresents = 0;
+
+	metrics.BytesWritten.fetch_add(written, std::memory_order_relaxed);
+}
+
+
+void Mirror::Start()
+{
+	ParseCpus(options.Cpus, cpus);
+
+	int count = converter->BufferCount();
+
+	// Buffers not being converted or presented can be queued
+	captureRing = new SpscRing<PipelineFrame>(2);
+	presentRing = new SpscRing<PipelineFrame>(count - 2);
+	freeRing = new SpscRing<int>(count);
+
+	for (int i = 0; i < count; ++i)
+	{
+		freeRing->Push(i, nullptr);
+	}
+
+	sem_init(&captureSignal, 0, 0);
+	sem_init(&presentSignal, 0, 0);
+
+	running = true;
+
+	// Capture stays on the calling thread
+	PinThread(cpus[0]);
+	convertThread = std::thread(&Mirror::ConvertLoop, this);
+	presentThread = std::thread(&Mirror::PresentLoop, this);
+
+	printf("pipeline: threaded, %d buffers, cpus %d,%d,%d\n", count, cpus[0], cpus[1], cpus[2]);
+}
+
+void Mirror::Stop()
+{
+	// A converted frame that will not be presented any more, so that
+	// produced = presented + dropped
+	if (pending >= 0)
+	{
+		++dropped;
+		pending = -1;
+	}
+
+	if (!running)
+		return;
+
+	running = false;
+
+	sem_post(&captureSignal);
+	sem_post(&presentSignal);
+
+	convertThread.join();
+	presentThread.join();
+
+	sem_destroy(&captureSignal);
+	sem_destroy(&presentSignal);
+}
+
+void Mirror::Capture(double frameStart, double vsyncEnd)
+{
+	if (!idle && detector && unchangedPresents >= IDLE_PRESENTS)
+	{
+		EnterIdle(vsyncEnd);
+	}
+
+	if (IsFrameDue(vsyncEnd))
+	{
+		PipelineFrame frame;
+		frame.Source = source.Data();
+		frame.SourceX = source.XOffset();
+		frame.SourceY = source.YOffset();
+		frame.Buffer = -1;
+		frame.CaptureTime = vsyncEnd;
+		frame.WakeTime = wakeTime;
+
+		wakeTime = 0;
+
+		// A capture the converter has not picked up yet is stale
+		if (!captureRing->Push(frame, nullptr))
+		{
+			++dropped;
+		}
+
+		sem_post(&captureSignal);
+	}
+
+	double captureEnd = GetTime();
+
+	metrics.VSync.Observe(vsyncEnd - frameStart);
+	metrics.Frame.Observe(captureEnd - frameStart);
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	vsyncTime.Add(vsyncEnd - frameStart);
+	frameTime.Add(captureEnd - frameStart);
+}
+
+void Mirror::ConvertLoop()
+{
+	PinThread(cpus[1]);
+	Tracer::Instance().NameThread("convert " + sink.DeviceName());
+
+	// Buffer evicted from the present ring, reused before the free ring
+	int spare = -1;
+
+	while (true)
+	{
+		sem_wait(&captureSignal);
+		if (!running)
+			break;
+
+		PipelineFrame frame;
+		if (!captureRing->Pop(&frame))
+			continue;
+
+		double start = GetTime();
+
+		if (spare >= 0)
+		{
+			frame.Buffer = spare;
+			spare = -1;
+		}
+		else if (!freeRing->Pop(&frame.Buffer))
+		{
+			// Every buffer is queued or being presented
+			++dropped;
+			continue;
+		}
+
+		double waitEnd = GetTime();
+
+		if (softwareConverter)
+		{
+			SetSoftwareSource(frame.Source);
+		}
+
+		converter->SetSourceOffset(frame.SourceX, frame.SourceY);
+		ApplySourceRect();
+		converter->Convert(frame.Buffer);
+		converter->Wait();
+		++produced;
+
+		double convertEnd = GetTime();
+
+		PipelineFrame evicted;
+		if (!presentRing->Push(frame, &evicted))
+		{
+			spare = evicted.Buffer;
+			++dropped;
+		}
+
+		sem_post(&presentSignal);
+
+		metrics.Wait.Observe(waitEnd - start);
+		metrics.Convert.Observe(convertEnd - waitEnd);
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		waitTime.Add(waitEnd - start);
+		convertTime.Add(convertEnd - waitEnd);
+	}
+}
+
+void Mirror::PresentLoop()
+{
+	PinThread(cpus[2]);
+	Tracer::Instance().NameThread("present " + sink.DeviceName());
+
+	while (true)
+	{
+		sem_wait(&presentSignal);
+		if (!running)
+			break;
+
+		PipelineFrame frame;
+		if (!presentRing->Pop(&frame))
+			continue;
+
+		double start = GetTime();
+
+		size_t written;
+		{
+			TraceScope trace("copy", sink.DeviceName().c_str(), frame.Buffer);
+			written = copy->Copy(sink.Data(), converter->Output(frame.Buffer));
+		}
+
+		{
+			TraceScope trace("present", sink.DeviceName().c_str(), frame.Buffer);
+			sink.Present();
+		}
+		++presented;
+
+		double end = GetTime();
+
+		freeRing->Push(frame.Buffer, nullptr);
+		CountPresent(written);
+
+		metrics.Copy.Observe(end - start);
+		metrics.Latency.Observe(end - frame.CaptureTime);
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		pacer->AddPresentTime(end - start);
+		copyTime.Add(end - start);
+		latency.Add(end - frame.CaptureTime);
+
+		if (frame.WakeTime > 0)
+		{
+			wakeLatency.Add(end - frame.WakeTime);
+		}
+	}
+}
+
+
+void Mirror::ParseCpus(const std::string& list, int* cpus)
+{
+	cpus[0] = cpus[1] = cpus[2] = -1;
+
+	if (list == "none")
+		return;
+
+	if (list == "auto")
+	{
+		// Leave the first core to interrupts and the desktop
+		if (sysconf(_SC_NPROCESSORS_ONLN) >= 4)
+		{
+			cpus[0] = 1;
+			cpus[1] = 2;
+			cpus[2] = 3;
+		}
+
+		return;
+	}
+
+	if (sscanf(list.c_str(), "%d,%d,%d", &cpus[0], &cpus[1], &cpus[2]) != 3)
+	{
+		throw Exception("invalid cpu list");
+	}
+}
+
+void Mirror::PinThread(int cpu)
+{
+	if (cpu < 0)
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int io = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (io != 0)
+	{
+		fprintf(stderr, "pthread_setaffinity_np cpu %d failed.\n", cpu);
+	}
+}
+
+
+void Mirror::EnterIdle(double now)
+{
+	detector->Reset(source.Data());
+
+	if (overlayDetector)
+		overlayDetector->Reset(overlay->Data());
+
+	idle = true;
+	idleStart = now;
+	lastUnchanged = now;
+	unchangedPresents = 0;
+}
+
+void Mirror::Wake(double changeTime)
+{
+	idle = false;
+	wakeTime = changeTime;
+	++wakes;
+}
+
+
+void Mirror::PrintStats() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	unsigned long long total = copy->BytesWritten() + copy->BytesSkipped();
+
+	printf("copy: written=%llu skipped=%llu (%.1f%% skipped)\n",
+		copy->BytesWritten(), copy->BytesSkipped(),
+		total ? 100.0 * copy->BytesSkipped() / total : 0.0);
+
+	double now = GetTime();
+	double rate = (statsTime > 0) ? (Presented() - statsPresented) / (now - statsTime) : 0;
+	statsTime = now;
+	statsPresented = Presented();
+
+	printf("frames: produced=%llu presented=%llu skipped=%llu idle=%llu (%.1f fps, pacing %.1f fps)\n",
+		Produced(), Presented(), skipped, idleFrames, rate, pacer->Rate());
+
+	printf("latency (ms): mean=%.3f p99=%.3f max=%.3f dropped=%llu\n",
+		latency.Mean() * 1000.0, latency.Percentile(0.99) * 1000.0, latency.Max() * 1000.0, Dropped());
+
+	if (wakes > 0)
+	{
+		printf("idle: wakes=%llu change to present (ms) mean=%.3f max=%.3f%s\n",
+			wakes, wakeLatency.Mean() * 1000.0, wakeLatency.Max() * 1000.0,
+			idle ? " (idle)" : "");
+	}
+
+	double hidden = 0;
+	if (!softwareConverter && !threaded && converter->BufferCount() > 1 && serialTime > 0)
+	{
+		hidden = 1.0 - (waitTime.Mean() + convertTime.Mean()) / serialTime;
+		if (hidden < 0)
+			hidden = 0;
+	}
+
+	printf("stages (ms): vsync=%.3f wait=%.3f convert=%.3f copy=%.3f frame=%.3f serial=%.3f overlap=%.0f%%\n",
+		vsyncTime.Mean() * 1000.0, waitTime.Mean() * 1000.0,
+		convertTime.Mean() * 1000.0, copyTime.Mean() * 1000.0,
+		frameTime.Mean() * 1000.0, serialTime * 1000.0,
+		hidden * 100.0);
+}
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+
+#include "FrameBuffer.h"
+#include "Converter.h"
+#include "SoftwareConverter.h"
+#include "DirtyCopy.h"
+#include "Statistics.h"
+#include "FramePacer.h"
+#include "ChangeDetector.h"
+#include "SpscRing.h"
+#include "IonBuffer.h"
+#include "Metrics.h"
+
+
+enum class AutotuneMode
+{
+	Off = 0,
+
+	// Use the saved profile, measure when there is none
+	Profile,
+
+	// Always measure
+	Force
+};
+
+
+struct MirrorOptions
+{
+	// auto, ge2d, cpu, scalar, sse2, avx2, neon
+	std::string Backend = "auto";
+
+	// -1 uses the source aspect ratio
+	float Aspect = -1;
+
+	// Clockwise rotation of the image on the LCD: 0, 90, 180, 270, or -1
+	// to turn a portrait panel to landscape
+	int Rotation = -1;
+
+	// Mirror the image horizontally and vertically
+	bool FlipH = false;
+	bool FlipV = false;
+
+	// Let GE2D rotate and flip. Its mapping has not been verified on
+	// hardware, so without this a transformed image is converted by the
+	// CPU.
+	bool Ge2dRotate = false;
+
+	// Part of the source to mirror; an empty rectangle is the whole source
+	Rectangle SourceRect = { 0, 0, 0, 0 };
+
+	// Number of output buffers
+	int Depth = 2;
+
+	// CPU mapping of the GE2D output: default, cached, wc, uncached
+	std::string IonCache = "default";
+
+	// Kernel writing the LCD: auto, memcpy, neon, stream
+	std::string Copy = "auto";
+
+	// Pick Backend, IonCache and Copy by measuring (AutoTuner)
+	AutotuneMode Autotune = AutotuneMode::Off;
+
+	// Where autotune results are kept
+	std::string Profile = "/var/cache/c2screen2lcd/profile";
+
+	// Let GE2D write the LCD framebuffer directly when possible
+	bool ZeroCopy = true;
+
+	// LCD output rate: -1 detects the panel rate, 0 disables pacing
+	double OutputRate = -1;
+
+	// Stop converting while the source does not change
+	bool Idle = true;
+
+	// Number of samples kept per stage
+	size_t StatsWindow = 1024;
+
+	// Run capture, conversion and presentation on separate threads
+	bool Threaded = false;
+
+	// CPUs for the capture, convert and present threads: auto, none or
+	// a list such as 1,2,3
+	std::string Cpus = "auto";
+
+	// ARGB8888 framebuffer (OSD1) composited over the source, empty for
+	// none
+	std::string Overlay;
+};
+
+
+// A frame moving through the threaded pipeline
+struct PipelineFrame
+{
+	const void* Source;
+	int SourceX;
+	int SourceY;
+	int Buffer;
+	double CaptureTime;
+	double WakeTime;
+};
+
+
+// Mirrors a source framebuffer onto an LCD framebuffer: wait for vsync,
+// convert, copy the changed pages.
+//
+// When threaded, RunFrame only captures. Conversion and presentation run
+// on their own threads, connected by rings that drop the oldest frame
+// when a later stage falls behind.
+class Mirror
+{
+	FrameBuffer& source;
+	FrameBuffer& sink;
+	FrameBuffer* overlay = nullptr;
+	Converter* converter = nullptr;
+	SoftwareConverter* softwareConverter = nullptr;
+	DirtyCopy* copy = nullptr;
+	bool zeroCopy = false;
+	FramePacer* pacer = nullptr;
+	MirrorOptions options;
+	Transform transform;
+
+	// Where the source is drawn in the logical (unrotated) sink image
+	Rectangle destination = { 0, 0, 0, 0 };
+
+	// Idle state
+	ChangeDetector* detector = nullptr;
+	ChangeDetector* overlayDetector = nullptr;
+	bool idle = false;
+	double idleStart = 0;
+
+	// Latest check that found the source unchanged; a change seen by the
+	// next check happened after it
+	double lastUnchanged = 0;
+
+	// Next buffer to convert into, and the converted buffer waiting to be
+	// copied out while the next conversion runs.
+	int current = 0;
+	int pending = -1;
+
+	// Capture time of the frame in each output buffer
+	std::vector<double> captureTimes;
+
+	// The frame between BeginFrame and EndFrame
+	struct FrameState
+	{
+		double Start;
+		double VSyncEnd;
+		double Begin;
+		double WaitEnd;
+		double ConvertEnd;
+		bool Due;
+		bool Active;
+		int Present;
+	} state;
+
+	double serialTime = 0;
+	double lastVSync = 0;
+	double sourcePeriod = 0;
+
+	unsigned long long frames = 0;
+	std::atomic<unsigned long long> produced;
+	std::atomic<unsigned long long> presented;
+	std::atomic<unsigned long long> dropped;
+	unsigned long long skipped = 0;
+	unsigned long long idleFrames = 0;
+	unsigned long long wakes = 0;
+	std::atomic<int> unchangedPresents;
+	static const int IDLE_PRESENTS = 30;
+	double wakeTime = 0;
+	Statistics wakeLatency;
+
+	// Source rectangle waiting to be applied by the converting thread
+	Rectangle sourceRect;
+	std::atomic<bool> sourceRectChanged;
+
+	// Threaded pipeline
+	bool threaded = false;
+	std::atomic<bool> running;
+	int cpus[3] = { -1, -1, -1 };
+	SpscRing<PipelineFrame>* captureRing = nullptr;
+	SpscRing<PipelineFrame>* presentRing = nullptr;
+	SpscRing<int>* freeRing = nullptr;
+	sem_t captureSignal;
+	sem_t presentSignal;
+	std::thread convertThread;
+	std::thread presentThread;
+	mutable std::mutex statsMutex;
+	Statistics latency;
+
+	// Lock-free copies of the stage times for the metrics endpoint
+	MirrorMetrics metrics;
+
+	// Errors of the converters replaced by Reconfigure
+	unsigned long long converterErrors = 0;
+
+	// Presented count and time at the last PrintStats, for the rate
+	mutable double statsTime = 0;
+	mutable unsigned long long statsPresented = 0;
+
+
+	static void ParseCpus(const std::string& list, int* cpus);
+	static void PinThread(int cpu);
+
+	void ClearSink(unsigned int argb = 0xffffffff);
+	void CreateConverter();
+	void CreateDetector();
+	void DeleteDetector();
+	bool SourceChanged();
+	void SetSoftwareSource(const void* data);
+
+	void ApplySourceRect();
+	Rectangle CalculateLetterbox(const Rectangle& rect) const;
+	bool IsFrameDue(double now);
+	void CountPresent(size_t written);
+	void EnterIdle(double now);
+	void Wake(double changeTime);
+
+	void Start();
+	void Capture(double frameStart, double vsyncEnd);
+	void ConvertLoop();
+	void PresentLoop();
+
+	Statistics vsyncTime;
+	Statistics waitTime;
+	Statistics convertTime;
+	Statistics copyTime;
+	Statistics frameTime;
+
+
+public:
+
+	const FrameBuffer& Source() const
+	{
+		return source;
+	}
+
+	const FrameBuffer& Sink() const
+	{
+		return sink;
+	}
+
+	// nullptr without --overlay
+	const FrameBuffer* Overlay() const
+	{
+		return overlay;
+	}
+
+	const Converter& GetConverter() const
+	{
+		return *converter;
+	}
+
+	const DirtyCopy& Copy() const
+	{
+		return *copy;
+	}
+
+	bool IsZeroCopy() const
+	{
+		return zeroCopy;
+	}
+
+	const FramePacer& Pacer() const
+	{
+		return *pacer;
+	}
+
+	// Source frames seen
+	unsigned long long Frames() const
+	{
+		return frames;
+	}
+
+	// Frames converted
+	unsigned long long Produced() const
+	{
+		return produced;
+	}
+
+	// Frames copied to the sink
+	unsigned long long Presented() const
+	{
+		return presented;
+	}
+
+	// Converted frames replaced by a newer one before they were presented
+	unsigned long long Dropped() const
+	{
+		return dropped;
+	}
+
+	// Source frames that were not converted because of pacing
+	unsigned long long Skipped() const
+	{
+		return skipped;
+	}
+
+	// Source frames that were not converted because nothing changed
+	unsigned long long IdleFrames() const
+	{
+		return idleFrames;
+	}
+
+	bool IsIdle() const
+	{
+		return idle;
+	}
+
+	// When the mirror last went idle
+	double IdleSince() const
+	{
+		return idleStart;
+	}
+
+	const Statistics& VSyncTime() const
+	{
+		return vsyncTime;
+	}
+
+	const Statistics& WaitTime() const
+	{
+		return waitTime;
+	}
+
+	const Statistics& ConvertTime() const
+	{
+		return convertTime;
+	}
+
+	const Statistics& CopyTime() const
+	{
+		return copyTime;
+	}
+
+	const Statistics& FrameTime() const
+	{
+		return frameTime;
+	}
+
+	// Capture to present
+	const Statistics& Latency() const
+	{
+		return latency;
+	}
+
+	bool IsThreaded() const
+	{
+		return threaded;
+	}
+
+	const MirrorMetrics& Metrics() const
+	{
+		return metrics;
+	}
+
+	// Failed GE2D calls since startup
+	unsigned long long ConverterErrors() const
+	{
+		return converterErrors + converter->Errors();
+	}
+
+
+	Mirror(FrameBuffer& source, FrameBuffer& sink, const MirrorOptions& options);
+	~Mirror();
+
+
+	// The rotation and flips of options, with an automatic rotation resolved
+	static Transform ResolveTransform(const FrameBuffer& sink, const MirrorOptions& options);
+
+	// False when GE2D would have to rotate or flip without Ge2dRotate
+	static bool IsGe2dTransformAllowed(const Transform& transform, const MirrorOptions& options);
+
+	// Physical address GE2D can write the sink at, or 0 with the reason
+	static unsigned long FindZeroCopyTarget(FrameBuffer& sink, const char*& reason);
+
+	static Rectangle CalculateDestination(int srcWidth, int srcHeight, int dstWidth, int dstHeight, float aspect);
+	static SimdLevel ParseSimdLevel(const std::string& name);
+	static IonCacheMode ParseIonCacheMode(const std::string& name);
+	static CopyMethod ParseCopyMethod(const std::string& name);
+
+
+	void RunFrame();
+
+	// RunFrame without the vsync wait, split so that several mirrors of
+	// one source can start all their conversions before any copy.
+	void BeginFrame(double start, double vsyncEnd);
+	void EndFrame();
+
+	void PrintStats() const;
+
+	// Mirrors only rect of the source from the next converted frame on.
+	// Without a forced aspect, a rect of another shape rebuilds the
+	// conversion around a new letterbox (see Reconfigure).
+	void SetSourceRect(const Rectangle& rect);
+
+	// Where the source is drawn in the logical sink image
+	const Rectangle& Destination() const
+	{
+		return destination;
+	}
+
+	// The region of the source that is mirrored
+	Rectangle MirroredRect() const;
+
+	// Where source pixel (x, y) of the mirrored region lands in the
+	// output buffers and the sink. False when it is not mirrored.
+	bool MapSourcePoint(int x, int y, int* outputX, int* outputY) const;
+
+	// Stops the pipeline threads; a converted frame not presented yet
+	// counts as dropped. Statistics are stable afterwards.
+	void Stop();
+
+	// Waits for the last conversion and fills the sink with black, the
+	// state the LCD is left in on exit. Call after Stop().
+	void Blank();
+
+	// Rebuilds the conversion after the source mode changed. The source
+	// must not be remapped before Stop() returned.
+	void Reconfigure();
+};
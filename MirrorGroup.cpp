@@ -0,0 +1,216 @@
+#include "MirrorGroup.h"
+
+#include <stdio.h>
+
+#include "IonPool.h"
+#include "Timing.h"
+#include "Tracer.h"
+#include "Exception.h"
+
+
+// Seconds between checks of the source mode. A check is two ioctls.
+const double MODE_CHECK_INTERVAL = 0.5;
+
+
+MirrorGroup::MirrorGroup(FrameBuffer& source)
+	: source(source)
+{
+}
+
+MirrorGroup::~MirrorGroup()
+{
+	for (Mirror* mirror : mirrors)
+	{
+		delete mirror;
+	}
+}
+
+
+void MirrorGroup::Add(Mirror* mirror)
+{
+	if (&mirror->Source() != &source)
+		throw Exception("mirror of another source");
+
+	mirrors.push_back(mirror);
+}
+
+void MirrorGroup::SetDim(int duty, double after)
+{
+	dimDuty = duty;
+	dimAfter = after;
+}
+
+
+void MirrorGroup::RunFrame()
+{
+	double start = GetTime();
+
+	// One capture for every sink
+	{
+		TraceScope trace("vsync", source.DeviceName().c_str());
+		source.WaitForVSync();
+	}
+	double vsyncEnd = GetTime();
+
+	if (lastVSync > 0)
+	{
+		double interval = vsyncEnd - lastVSync;
+
+		// The vsyncs slept through are counted but kept out of the
+		// period, unless the source really slowed down
+		const int SLOW_INTERVALS = 8;
+
+		if (sourcePeriod > 0 && interval > sourcePeriod * 1.5 && ++slowIntervals < SLOW_INTERVALS)
+		{
+			missedVSyncs += (unsigned long long)(interval / sourcePeriod + 0.5) - 1;
+		}
+		else
+		{
+			if (slowIntervals >= SLOW_INTERVALS)
+				sourcePeriod = interval;
+
+			sourcePeriod = (sourcePeriod == 0) ? interval : sourcePeriod + (interval - sourcePeriod) * 0.1;
+			slowIntervals = 0;
+		}
+	}
+
+	lastVSync = vsyncEnd;
+
+	for (Mirror* mirror : mirrors)
+	{
+		mirror->BeginFrame(start, vsyncEnd);
+	}
+
+	for (Mirror* mirror : mirrors)
+	{
+		mirror->EndFrame();
+	}
+
+	UpdateBacklight(vsyncEnd);
+
+	// Every sink has to be done before the next vsync
+	if (sourcePeriod > 0 && GetTime() - vsyncEnd > sourcePeriod)
+	{
+		++lateFrames;
+	}
+}
+
+void MirrorGroup::UpdateBacklight(double now)
+{
+	if (dimDuty < 0)
+		return;
+
+	// The latest of the mirrors to go idle
+	double idleSince = 0;
+
+	for (Mirror* mirror : mirrors)
+	{
+		if (!mirror->IsIdle())
+		{
+			backlight.Restore();
+			return;
+		}
+
+		if (mirror->IdleSince() > idleSince)
+			idleSince = mirror->IdleSince();
+	}
+
+	if (!backlight.IsDimmed() && now - idleSince >= dimAfter)
+	{
+		if (backlight.Dim(dimDuty))
+			printf("idle: backlight dimmed\n");
+	}
+}
+
+void MirrorGroup::Stop()
+{
+	for (Mirror* mirror : mirrors)
+	{
+		mirror->Stop();
+	}
+}
+
+double MirrorGroup::NextFrameTime() const
+{
+	if (sourcePeriod == 0)
+		return 0;
+
+	return lastVSync + sourcePeriod * 0.75;
+}
+
+void MirrorGroup::Blank()
+{
+	Stop();
+
+	for (Mirror* mirror : mirrors)
+	{
+		mirror->Blank();
+	}
+}
+
+bool MirrorGroup::CheckMode()
+{
+	double now = GetTime();
+	if (now - lastModeCheck < MODE_CHECK_INTERVAL)
+		return false;
+
+	lastModeCheck = now;
+
+	if (!source.IsModeChanged())
+		return false;
+
+	Reconfigure();
+
+	return true;
+}
+
+void MirrorGroup::Reconfigure()
+{
+	double start = GetTime();
+
+	// No conversion may read the old mapping while it is replaced
+	Stop();
+	source.UpdateMode();
+
+	for (Mirror* mirror : mirrors)
+	{
+		mirror->Reconfigure();
+	}
+
+	++reconfigurations;
+
+	// The refresh rate may have changed with the mode
+	lastVSync = 0;
+	sourcePeriod = 0;
+	slowIntervals = 0;
+
+	printf("mode: %s is now %dx%d %s, reconfigured in %.1f ms (%u so far)\n",
+		source.DeviceName().c_str(), source.Width(), source.Height(),
+		source.Format().Name().c_str(), (GetTime() - start) * 1000.0, reconfigurations);
+}
+
+void MirrorGroup::SetSourceRect(const Rectangle& rect)
+{
+	for (Mirror* mirror : mirrors)
+	{
+		mirror->SetSourceRect(rect);
+	}
+}
+
+void MirrorGroup::PrintStats() const
+{
+	for (Mirror* mirror : mirrors)
+	{
+		if (mirrors.size() > 1)
+			printf("[%s]\n", mirror->Sink().DeviceName().c_str());
+
+		mirror->PrintStats();
+	}
+
+	printf("deadlines: %llu late frames, %llu missed vsyncs\n", lateFrames, missedVSyncs);
+
+	if (IonPool::Instance().SlabCount() > 0)
+	{
+		IonPool::Instance().PrintStats();
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "FrameBuffer.h"
+#include "Mirror.h"
+#include "Backlight.h"
+
+
+// A sink and the options it is mirrored with
+struct SinkConfig
+{
+	std::string Spec;
+	MirrorOptions Options;
+};
+
+
+// Mirrors one source onto several sinks. The source vsync is waited for
+// once per frame and every sink starts its conversion before any sink
+// copies, so the GE2D jobs of a frame run back to back on the same source
+// frame.
+class MirrorGroup
+{
+	FrameBuffer& source;
+	std::vector<Mirror*> mirrors;
+	double lastModeCheck = 0;
+	unsigned int reconfigurations = 0;
+
+	// Smoothed interval between source vsyncs
+	double lastVSync = 0;
+	double sourcePeriod = 0;
+	int slowIntervals = 0;
+
+	unsigned long long lateFrames = 0;
+	unsigned long long missedVSyncs = 0;
+
+	// The LCDs share one backlight, dimmed only while every mirror is
+	// idle
+	Backlight backlight;
+	int dimDuty = -1;
+	double dimAfter = 30;
+
+
+	void UpdateBacklight(double now);
+
+
+public:
+
+	const std::vector<Mirror*>& Mirrors() const
+	{
+		return mirrors;
+	}
+
+	const FrameBuffer& Source() const
+	{
+		return source;
+	}
+
+	// Mode changes handled so far
+	unsigned int Reconfigurations() const
+	{
+		return reconfigurations;
+	}
+
+	// Source frames seen
+	unsigned long long Frames() const
+	{
+		return mirrors.empty() ? 0 : mirrors[0]->Frames();
+	}
+
+	// Frames whose conversions and copies were not all done by the next
+	// source vsync
+	unsigned long long LateFrames() const
+	{
+		return lateFrames;
+	}
+
+	// Source vsyncs that passed while the loop was not waiting for them
+	unsigned long long MissedVSyncs() const
+	{
+		return missedVSyncs;
+	}
+
+
+	MirrorGroup(FrameBuffer& source);
+	~MirrorGroup();
+
+
+	// Takes ownership of mirror, which must mirror the group's source
+	void Add(Mirror* mirror);
+
+	// Backlight duty once every mirror has been idle for after seconds;
+	// a negative duty keeps the backlight on
+	void SetDim(int duty, double after);
+
+	void RunFrame();
+	void Stop();
+
+	// When RunFrame should next be called: a quarter frame before the
+	// expected vsync, so the vsync wait inside is short. 0 until the
+	// source rate is known.
+	double NextFrameTime() const;
+
+	// Stops the pipelines and leaves every sink black
+	void Blank();
+
+	// Checks now and then whether the source mode changed (HDMI hotplug,
+	// fbset) and reconfigures every mirror when it did. Returns true
+	// after a reconfiguration.
+	bool CheckMode();
+	void Reconfigure();
+
+	// Region of the source shown on every sink
+	void SetSourceRect(const Rectangle& rect);
+
+	void PrintStats() const;
+};
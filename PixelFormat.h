@@ -0,0 +1,210 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+
+
+// Bit position of one color channel, as in fb_bitfield
+struct PixelChannel
+{
+	int Offset;
+	int Length;
+};
+
+
+// Layout of a pixel: size of the container and where each channel is,
+// following fb_var_screeninfo. Pixels are stored little endian.
+struct PixelFormat
+{
+	int BitsPerPixel = 0;
+	PixelChannel Red = { 0, 0 };
+	PixelChannel Green = { 0, 0 };
+	PixelChannel Blue = { 0, 0 };
+
+
+	int BytesPerPixel() const
+	{
+		return (BitsPerPixel + 7) / 8;
+	}
+
+	bool operator==(const PixelFormat& other) const
+	{
+		return BitsPerPixel == other.BitsPerPixel &&
+			Red.Offset == other.Red.Offset && Red.Length == other.Red.Length &&
+			Green.Offset == other.Green.Offset && Green.Length == other.Green.Length &&
+			Blue.Offset == other.Blue.Offset && Blue.Length == other.Blue.Length;
+	}
+
+	bool operator!=(const PixelFormat& other) const
+	{
+		return !(*this == other);
+	}
+
+
+	static PixelFormat Make(int bpp, int redOffset, int redLength,
+		int greenOffset, int greenLength, int blueOffset, int blueLength)
+	{
+		PixelFormat result;
+		result.BitsPerPixel = bpp;
+		result.Red = { redOffset, redLength };
+		result.Green = { greenOffset, greenLength };
+		result.Blue = { blueOffset, blueLength };
+
+		return result;
+	}
+
+	static PixelFormat Rgb565()
+	{
+		return Make(16, 11, 5, 5, 6, 0, 5);
+	}
+
+	// Blue in the first byte, as fbdev lays out 24 bpp
+	static PixelFormat Rgb888()
+	{
+		return Make(24, 16, 8, 8, 8, 0, 8);
+	}
+
+	static PixelFormat Bgr888()
+	{
+		return Make(24, 0, 8, 8, 8, 16, 8);
+	}
+
+	// 18 bit color in three bytes, red first, each channel in the top
+	// six bits of its byte. This is what the ILI9488 takes over SPI.
+	static PixelFormat Rgb666()
+	{
+		return Make(24, 2, 6, 10, 6, 18, 6);
+	}
+
+	static PixelFormat Xrgb8888()
+	{
+		return Make(32, 16, 8, 8, 8, 0, 8);
+	}
+
+	static PixelFormat Xbgr8888()
+	{
+		return Make(32, 0, 8, 8, 8, 16, 8);
+	}
+
+	// The usual fbdev layout for a depth. 18 selects Rgb666.
+	static PixelFormat FromBitsPerPixel(int bpp)
+	{
+		switch (bpp)
+		{
+			case 16:
+				return Rgb565();
+
+			case 18:
+				return Rgb666();
+
+			case 24:
+				return Rgb888();
+
+			case 32:
+				return Xrgb8888();
+
+			default:
+				return PixelFormat();
+		}
+	}
+
+
+	bool IsSupported() const
+	{
+		if (BitsPerPixel != 16 && BitsPerPixel != 24 && BitsPerPixel != 32)
+			return false;
+
+		const PixelChannel* channels[] = { &Red, &Green, &Blue };
+		for (const PixelChannel* channel : channels)
+		{
+			if (channel->Length < 1 || channel->Length > 8 ||
+				channel->Offset < 0 || channel->Offset + channel->Length > BitsPerPixel)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	std::string Name() const
+	{
+		const struct
+		{
+			PixelFormat Format;
+			const char* Name;
+		} known[] =
+		{
+			{ Rgb565(), "rgb565" },
+			{ Rgb888(), "rgb888" },
+			{ Bgr888(), "bgr888" },
+			{ Rgb666(), "rgb666" },
+			{ Xrgb8888(), "xrgb8888" },
+			{ Xbgr8888(), "xbgr8888" }
+		};
+
+		for (const auto& entry : known)
+		{
+			if (entry.Format == *this)
+				return entry.Name;
+		}
+
+		char text[64];
+		snprintf(text, sizeof(text), "%dbpp-r%d:%d-g%d:%d-b%d:%d", BitsPerPixel,
+			Red.Offset, Red.Length, Green.Offset, Green.Length, Blue.Offset, Blue.Length);
+
+		return text;
+	}
+
+
+	// Converts between a pixel value and 0xffRRGGBB
+	unsigned int Pack(unsigned int argb) const
+	{
+		return PackChannel(argb >> 16, Red) | PackChannel(argb >> 8, Green) | PackChannel(argb, Blue);
+	}
+
+	unsigned int Unpack(unsigned int pixel) const
+	{
+		return 0xff000000 | (UnpackChannel(pixel, Red) << 16) |
+			(UnpackChannel(pixel, Green) << 8) | UnpackChannel(pixel, Blue);
+	}
+
+	unsigned int Load(const void* data) const
+	{
+		const unsigned char* p = (const unsigned char*)data;
+
+		unsigned int result = 0;
+		for (int i = 0; i < BytesPerPixel(); ++i)
+		{
+			result |= (unsigned int)p[i] << (i * 8);
+		}
+
+		return result;
+	}
+
+	void Store(void* data, unsigned int pixel) const
+	{
+		unsigned char* p = (unsigned char*)data;
+
+		for (int i = 0; i < BytesPerPixel(); ++i)
+		{
+			p[i] = pixel >> (i * 8);
+		}
+	}
+
+
+private:
+
+	static unsigned int PackChannel(unsigned int value, const PixelChannel& channel)
+	{
+		return ((value & 0xff) >> (8 - channel.Length)) << channel.Offset;
+	}
+
+	static unsigned int UnpackChannel(unsigned int pixel, const PixelChannel& channel)
+	{
+		unsigned int max = (1u << channel.Length) - 1;
+		unsigned int value = (pixel >> channel.Offset) & max;
+
+		return (value * 255 + max / 2) / max;
+	}
+};
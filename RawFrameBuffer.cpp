@@ -0,0 +1,127 @@
+#include "RawFrameBuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Exception.h"
+
+
+static bool ReadFile(const char* path, std::vector<unsigned char>& result)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	size_t offset = result.size();
+	result.resize(offset + size);
+
+	bool ok = fread(result.data() + offset, 1, size, file) == (size_t)size;
+	fclose(file);
+
+	if (!ok)
+		throw Exception("read failed.");
+
+	return true;
+}
+
+
+RawFrameBuffer::RawFrameBuffer(const char* path, int width, int height, const PixelFormat& format, double refreshRate)
+	: FrameBuffer(path), path(path), vsyncTimer(refreshRate)
+{
+	this->width = width;
+	this->height = height;
+	this->bpp = format.BitsPerPixel;
+	this->format = format;
+	length = width * height * format.BytesPerPixel();
+
+	LoadFrames();
+}
+
+
+void RawFrameBuffer::LoadFrames()
+{
+	if (strchr(path.c_str(), '%'))
+	{
+		char name[1024];
+
+		for (int i = 0; ; ++i)
+		{
+			snprintf(name, sizeof(name), path.c_str(), i);
+
+			size_t before = frames.size();
+			if (!ReadFile(name, frames))
+				break;
+
+			// Pad or truncate each file to exactly one frame
+			frames.resize(before + length);
+		}
+	}
+	else
+	{
+		ReadFile(path.c_str(), frames);
+		frames.resize(frames.size() - (frames.size() % length));
+	}
+
+	frameCount = frames.size() / length;
+	loaded = (frameCount > 0);
+
+	if (frameCount == 0)
+	{
+		// Used as a sink; provide a single frame to write into.
+		frames.resize(length);
+		frameCount = 1;
+	}
+
+	data = frames.data();
+}
+
+
+void RawFrameBuffer::WaitForVSync()
+{
+	// Only sources wait for vsync; a mistyped source path must not turn
+	// into a blank frame
+	if (!loaded)
+	{
+		fprintf(stderr, "%s: no frame could be read\n", path.c_str());
+		throw Exception("raw source not found");
+	}
+
+	vsyncTimer.Wait();
+
+	frameIndex = (frameIndex + 1) % frameCount;
+	data = frames.data() + (size_t)frameIndex * length;
+}
+
+void RawFrameBuffer::Present()
+{
+	char name[1024];
+
+	if (strchr(path.c_str(), '%'))
+	{
+		snprintf(name, sizeof(name), path.c_str(), presentCount);
+	}
+	else
+	{
+		snprintf(name, sizeof(name), "%s.%04d", path.c_str(), presentCount);
+	}
+
+	FILE* file = fopen(name, "wb");
+	if (file == nullptr)
+	{
+		throw Exception("fopen failed.");
+	}
+
+	size_t written = fwrite(data, 1, length, file);
+	fclose(file);
+
+	if (written != (size_t)length)
+	{
+		throw Exception("write failed.");
+	}
+
+	++presentCount;
+}
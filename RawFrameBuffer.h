@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "FrameBuffer.h"
+#include "VSyncTimer.h"
+
+
+// Raw image sequence. As a source every vsync advances to the next
+// frame (looping); as a sink every Present writes a numbered file.
+// Without a readable frame it can only be a sink, and waiting for a
+// vsync on it throws.
+class RawFrameBuffer : public FrameBuffer
+{
+	std::string path;
+	std::vector<unsigned char> frames;
+	bool loaded = false;
+	int frameCount = 0;
+	int frameIndex = 0;
+	int presentCount = 0;
+	VSyncTimer vsyncTimer;
+
+
+	void LoadFrames();
+
+
+public:
+
+	int FrameCount() const
+	{
+		return frameCount;
+	}
+
+
+	RawFrameBuffer(const char* path, int width, int height, const PixelFormat& format, double refreshRate);
+
+
+	virtual void WaitForVSync() override;
+	virtual void Present() override;
+};
@@ -0,0 +1,118 @@
+#include "Realtime.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+
+// Where Prefault leaves the bytes it read, so the reads are not removed
+static volatile unsigned char prefaultSink;
+
+
+int Realtime::DefaultCpu()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 1) ? (int)count - 1 : -1;
+}
+
+
+bool Realtime::Pin(int cpu)
+{
+	if (cpu < 0)
+		return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int io = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (io != 0)
+	{
+		fprintf(stderr, "realtime: pinning to cpu %d failed (%s), running unpinned\n", cpu, strerror(io));
+		return false;
+	}
+
+	printf("realtime: pinned to cpu %d\n", cpu);
+	return true;
+}
+
+
+bool Realtime::SetFifo(int priority)
+{
+	sched_param param = { 0 };
+	param.sched_priority = priority;
+
+	int io = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (io == 0)
+	{
+		printf("realtime: SCHED_FIFO priority %d\n", priority);
+		return true;
+	}
+
+	fprintf(stderr, "realtime: SCHED_FIFO failed (%s); needs CAP_SYS_NICE or RLIMIT_RTPRIO >= %d\n",
+		strerror(io), priority);
+
+
+	// Second best: ahead of the other SCHED_OTHER tasks
+	const int NICE = -10;
+
+	if (setpriority(PRIO_PROCESS, 0, NICE) == 0)
+	{
+		printf("realtime: nice %d instead\n", NICE);
+	}
+	else
+	{
+		fprintf(stderr, "realtime: raising the nice value failed (%s), default scheduling\n", strerror(errno));
+	}
+
+	return false;
+}
+
+
+void Realtime::Prefault(const void* data, size_t length)
+{
+	if (data == nullptr || length == 0)
+		return;
+
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	// Reads only; the source must not be disturbed
+	const volatile unsigned char* bytes = (const volatile unsigned char*)data;
+	unsigned char sum = 0;
+
+	for (size_t offset = 0; offset < length; offset += page)
+	{
+		sum += bytes[offset];
+	}
+
+	sum += bytes[length - 1];
+
+	prefaultSink = sum;
+}
+
+
+bool Realtime::LockMemory()
+{
+	// Stack the loop may grow into later, faulted in before the lock
+	const size_t STACK_RESERVE = 256 * 1024;
+
+	volatile unsigned char reserve[STACK_RESERVE];
+	memset((void*)reserve, 0, sizeof(reserve));
+
+	// Not MCL_FUTURE: with a limited RLIMIT_MEMLOCK it would make later
+	// allocations, such as the buffers of a reconfiguration, fail.
+	if (mlockall(MCL_CURRENT) < 0)
+	{
+		fprintf(stderr, "realtime: mlockall failed (%s); needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK, pages may fault\n",
+			strerror(errno));
+		return false;
+	}
+
+	printf("realtime: memory locked\n");
+	return true;
+}
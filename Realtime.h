@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+
+// Hardening of the mirror loop against preemption and page faults on a
+// loaded box. Every step only warns when the process lacks the privilege
+// for it (CAP_SYS_NICE or RLIMIT_RTPRIO, CAP_IPC_LOCK or RLIMIT_MEMLOCK)
+// and the mirror keeps running without it.
+class Realtime
+{
+public:
+
+	// The core the loop is pinned to by default: the last online one,
+	// away from the interrupts and the desktop on the first
+	static int DefaultCpu();
+
+	// Pins the calling thread to cpu
+	static bool Pin(int cpu);
+
+	// Runs the calling thread SCHED_FIFO at priority (1-99). Threads it
+	// starts afterwards inherit the policy. Without the privilege the
+	// nice value is raised instead, if that is allowed.
+	static bool SetFifo(int priority);
+
+	// Faults in every page of a mapping, so that the first frames do not.
+	// Framebuffer and ION mappings are device memory, which mlockall
+	// leaves alone.
+	static void Prefault(const void* data, size_t length);
+
+	// Locks the current mappings and a reserve of stack into memory.
+	// Mappings made later are not locked; call again after them.
+	static bool LockMemory();
+};
@@ -0,0 +1,913 @@
+#include "SoftwareConverter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2 1
+#endif
+
+#include "Exception.h"
+#include "Tracer.h"
+
+
+// Sampling weights have 7 fractional bits so that a weighted byte
+// (255 * 128) still fits a signed 16 bit lane.
+const int WEIGHT_BITS = 7;
+const unsigned int WEIGHT_ONE = 1 << WEIGHT_BITS;
+
+
+static inline unsigned int LerpPixel(unsigned int a, unsigned int b, unsigned int weight)
+{
+	// Two channels per multiply (SWAR)
+	unsigned int inverse = WEIGHT_ONE - weight;
+
+	unsigned int rb = ((a & 0x00ff00ff) * inverse + (b & 0x00ff00ff) * weight + 0x00400040) >> WEIGHT_BITS;
+	unsigned int ag = (((a >> 8) & 0x00ff00ff) * inverse + ((b >> 8) & 0x00ff00ff) * weight + 0x00400040) >> WEIGHT_BITS;
+
+	return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+// Straight alpha: the overlay color weighted by its alpha over the
+// opaque image. t / 255 is rounded exactly as (t + 128 + ((t + 128) >> 8)) >> 8.
+static inline unsigned int BlendPixel(unsigned int d, unsigned int o)
+{
+	unsigned int a = o >> 24;
+	unsigned int inverse = 255 - a;
+
+	unsigned int rb = (o & 0x00ff00ff) * a + (d & 0x00ff00ff) * inverse + 0x00800080;
+	unsigned int g = ((o >> 8) & 0xff) * a + ((d >> 8) & 0xff) * inverse + 0x80;
+
+	rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+	g = ((g + (g >> 8)) >> 8) & 0xff;
+
+	return 0xff000000 | rb | (g << 8);
+}
+
+static inline unsigned short PackPixel(unsigned int p)
+{
+	return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+}
+
+
+// Scalar reference
+static void BlendRowsScalar(unsigned int* dst, const unsigned int* a, const unsigned int* b, int count, unsigned int weight)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		dst[i] = LerpPixel(a[i], b[i], weight);
+	}
+}
+
+static void BlendOverlayScalar(unsigned int* dst, const unsigned int* overlay, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		dst[i] = BlendPixel(dst[i], overlay[i]);
+	}
+}
+
+static void PackRowScalar(unsigned short* dst, const unsigned int* src, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		dst[i] = PackPixel(src[i]);
+	}
+}
+
+
+#if defined(HAVE_SSE2)
+static void BlendRowsSse2(unsigned int* dst, const unsigned int* a, const unsigned int* b, int count, unsigned int weight)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w0 = _mm_set1_epi16(WEIGHT_ONE - weight);
+	const __m128i w1 = _mm_set1_epi16(weight);
+	const __m128i round = _mm_set1_epi16(WEIGHT_ONE / 2);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), w0),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), w1));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), w0),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), w1));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), WEIGHT_BITS);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), WEIGHT_BITS);
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	BlendRowsScalar(dst + i, a + i, b + i, count - i, weight);
+}
+
+static inline __m128i PackPixelsSse2(__m128i p)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+	__m128i v = _mm_or_si128(_mm_or_si128(r, g), b);
+
+	// Sign extend so packs_epi32 keeps the bit pattern
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+// Blends the pixels of one half (unpacked to 16 bit lanes)
+static inline __m128i BlendHalfSse2(__m128i d, __m128i o)
+{
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i round = _mm_set1_epi16(128);
+
+	// The alpha of each pixel in all four of its lanes
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(o, 0xff), 0xff);
+
+	__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(o, a), _mm_mullo_epi16(d, _mm_sub_epi16(full, a))), round);
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void BlendOverlaySse2(unsigned int* dst, const unsigned int* overlay, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi32(0xff000000);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i o = _mm_loadu_si128((const __m128i*)(overlay + i));
+
+		__m128i lo = BlendHalfSse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(o, zero));
+		__m128i hi = BlendHalfSse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(o, zero));
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+	}
+
+	BlendOverlayScalar(dst + i, overlay + i, count - i);
+}
+
+static void PackRowSse2(unsigned short* dst, const unsigned int* src, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i v0 = PackPixelsSse2(_mm_loadu_si128((const __m128i*)(src + i)));
+		__m128i v1 = PackPixelsSse2(_mm_loadu_si128((const __m128i*)(src + i + 4)));
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(v0, v1));
+	}
+
+	PackRowScalar(dst + i, src + i, count - i);
+}
+#endif
+
+
+#if defined(HAVE_AVX2)
+__attribute__((target("avx2")))
+static void BlendRowsAvx2(unsigned int* dst, const unsigned int* a, const unsigned int* b, int count, unsigned int weight)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i w0 = _mm256_set1_epi16(WEIGHT_ONE - weight);
+	const __m256i w1 = _mm256_set1_epi16(weight);
+	const __m256i round = _mm256_set1_epi16(WEIGHT_ONE / 2);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), w0),
+			_mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), w1));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), w0),
+			_mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), w1));
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), WEIGHT_BITS);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), WEIGHT_BITS);
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	BlendRowsScalar(dst + i, a + i, b + i, count - i, weight);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i PackPixelsAvx2(__m256i p)
+{
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07e0));
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001f));
+
+	return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i BlendHalfAvx2(__m256i d, __m256i o)
+{
+	const __m256i full = _mm256_set1_epi16(255);
+	const __m256i round = _mm256_set1_epi16(128);
+
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(o, 0xff), 0xff);
+
+	__m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(o, a),
+		_mm256_mullo_epi16(d, _mm256_sub_epi16(full, a))), round);
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void BlendOverlayAvx2(unsigned int* dst, const unsigned int* overlay, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i opaque = _mm256_set1_epi32(0xff000000);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i o = _mm256_loadu_si256((const __m256i*)(overlay + i));
+
+		// Unpacking and packing both work per 128 bit lane, so the
+		// pixels stay in order
+		__m256i lo = BlendHalfAvx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(o, zero));
+		__m256i hi = BlendHalfAvx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(o, zero));
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+	}
+
+	BlendOverlayScalar(dst + i, overlay + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void PackRowAvx2(unsigned short* dst, const unsigned int* src, int count)
+{
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i v0 = PackPixelsAvx2(_mm256_loadu_si256((const __m256i*)(src + i)));
+		__m256i v1 = PackPixelsAvx2(_mm256_loadu_si256((const __m256i*)(src + i + 8)));
+
+		// packus works per 128 bit lane; restore pixel order
+		__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(v0, v1), 0xd8);
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+	}
+
+	PackRowScalar(dst + i, src + i, count - i);
+}
+#endif
+
+
+#if defined(HAVE_NEON)
+static void BlendRowsNeon(unsigned int* dst, const unsigned int* a, const unsigned int* b, int count, unsigned int weight)
+{
+	const uint8x8_t w0 = vdup_n_u8(WEIGHT_ONE - weight);
+	const uint8x8_t w1 = vdup_n_u8(weight);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint8x16_t va = vld1q_u8((const uint8_t*)(a + i));
+		uint8x16_t vb = vld1q_u8((const uint8_t*)(b + i));
+
+		uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), w0), vget_low_u8(vb), w1);
+		uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), w0), vget_high_u8(vb), w1);
+
+		uint8x16_t v = vcombine_u8(vrshrn_n_u16(lo, WEIGHT_BITS), vrshrn_n_u16(hi, WEIGHT_BITS));
+		vst1q_u8((uint8_t*)(dst + i), v);
+	}
+
+	BlendRowsScalar(dst + i, a + i, b + i, count - i, weight);
+}
+
+static void BlendOverlayNeon(unsigned int* dst, const unsigned int* overlay, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// b, g, r, a
+		uint8x8x4_t d = vld4_u8((const uint8_t*)(dst + i));
+		uint8x8x4_t o = vld4_u8((const uint8_t*)(overlay + i));
+
+		uint8x8_t a = o.val[3];
+		uint8x8_t inverse = vmvn_u8(a);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			uint16x8_t t = vmlal_u8(vmull_u8(o.val[c], a), d.val[c], inverse);
+			d.val[c] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+		}
+
+		d.val[3] = vdup_n_u8(0xff);
+		vst4_u8((uint8_t*)(dst + i), d);
+	}
+
+	BlendOverlayScalar(dst + i, overlay + i, count - i);
+}
+
+static void PackRowNeon(unsigned short* dst, const unsigned int* src, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// b, g, r, a
+		uint8x8x4_t px = vld4_u8((const uint8_t*)(src + i));
+
+		uint16x8_t v = vshll_n_u8(px.val[2], 8);
+		v = vsriq_n_u16(v, vshll_n_u8(px.val[1], 8), 5);
+		v = vsriq_n_u16(v, vshll_n_u8(px.val[0], 8), 11);
+
+		vst1q_u16(dst + i, v);
+	}
+
+	PackRowScalar(dst + i, src + i, count - i);
+}
+#endif
+
+
+// Pixel layout known at compile time, so that the shifts and masks of the
+// row loops are constants.
+template <int Bytes, int RedOffset, int RedLength, int GreenOffset, int GreenLength, int BlueOffset, int BlueLength>
+struct Layout
+{
+	static const int BYTES = Bytes;
+
+
+	static PixelFormat Format()
+	{
+		return PixelFormat::Make(Bytes * 8, RedOffset, RedLength, GreenOffset, GreenLength, BlueOffset, BlueLength);
+	}
+
+	static inline unsigned int Load(const unsigned char* p)
+	{
+		switch (Bytes)
+		{
+			case 2:
+				return p[0] | (p[1] << 8);
+
+			case 3:
+				return p[0] | (p[1] << 8) | (p[2] << 16);
+
+			default:
+				return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+		}
+	}
+
+	static inline void Store(unsigned char* p, unsigned int value)
+	{
+		p[0] = value;
+		p[1] = value >> 8;
+
+		if (Bytes > 2)
+			p[2] = value >> 16;
+
+		if (Bytes > 3)
+			p[3] = value >> 24;
+	}
+
+	// Replicates the top bits into the low bits, as the RGB565 unpacking
+	// always did
+	template <int Length>
+	static inline unsigned int Expand(unsigned int value)
+	{
+		value &= (1u << Length) - 1;
+		return (value << (8 - Length)) | (value >> (2 * Length - 8));
+	}
+
+	static inline unsigned int Unpack(unsigned int value)
+	{
+		return 0xff000000 |
+			(Expand<RedLength>(value >> RedOffset) << 16) |
+			(Expand<GreenLength>(value >> GreenOffset) << 8) |
+			Expand<BlueLength>(value >> BlueOffset);
+	}
+
+	static inline unsigned int Pack(unsigned int p)
+	{
+		return ((((p >> 16) & 0xff) >> (8 - RedLength)) << RedOffset) |
+			((((p >> 8) & 0xff) >> (8 - GreenLength)) << GreenOffset) |
+			(((p & 0xff) >> (8 - BlueLength)) << BlueOffset);
+	}
+};
+
+typedef Layout<2, 11, 5, 5, 6, 0, 5> Rgb565Layout;
+typedef Layout<3, 16, 8, 8, 8, 0, 8> Rgb888Layout;
+typedef Layout<3, 0, 8, 8, 8, 16, 8> Bgr888Layout;
+typedef Layout<3, 2, 6, 10, 6, 18, 6> Rgb666Layout;
+typedef Layout<4, 16, 8, 8, 8, 0, 8> Xrgb8888Layout;
+typedef Layout<4, 0, 8, 8, 8, 16, 8> Xbgr8888Layout;
+
+
+template <typename L>
+static void UnpackPixels(unsigned int* dst, const unsigned char* src, int start, int end, const PixelFormat&)
+{
+	for (int x = start; x < end; ++x)
+	{
+		dst[x] = L::Unpack(L::Load(src + x * L::BYTES));
+	}
+}
+
+template <typename L>
+static void PackPixels(unsigned char* dst, const unsigned int* src, int count, const PixelFormat&)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		L::Store(dst + i * L::BYTES, L::Pack(src[i]));
+	}
+}
+
+// Any other layout, with the offsets read at run time
+static void UnpackPixelsBitfields(unsigned int* dst, const unsigned char* src, int start, int end, const PixelFormat& format)
+{
+	int bytes = format.BytesPerPixel();
+
+	for (int x = start; x < end; ++x)
+	{
+		dst[x] = format.Unpack(format.Load(src + x * bytes));
+	}
+}
+
+static void PackPixelsBitfields(unsigned char* dst, const unsigned int* src, int count, const PixelFormat& format)
+{
+	int bytes = format.BytesPerPixel();
+
+	for (int i = 0; i < count; ++i)
+	{
+		format.Store(dst + i * bytes, format.Pack(src[i]));
+	}
+}
+
+
+SoftwareConverter::UnpackPixelsFunc SoftwareConverter::SelectUnpackPixels(const PixelFormat& format)
+{
+	if (format == Rgb565Layout::Format())
+		return UnpackPixels<Rgb565Layout>;
+
+	if (format == Rgb888Layout::Format())
+		return UnpackPixels<Rgb888Layout>;
+
+	if (format == Bgr888Layout::Format())
+		return UnpackPixels<Bgr888Layout>;
+
+	if (format == Rgb666Layout::Format())
+		return UnpackPixels<Rgb666Layout>;
+
+	if (format == Xrgb8888Layout::Format())
+		return UnpackPixels<Xrgb8888Layout>;
+
+	if (format == Xbgr8888Layout::Format())
+		return UnpackPixels<Xbgr8888Layout>;
+
+	return UnpackPixelsBitfields;
+}
+
+SoftwareConverter::PackPixelsFunc SoftwareConverter::SelectPackPixels(const PixelFormat& format)
+{
+	if (format == Rgb565Layout::Format())
+		return PackPixels<Rgb565Layout>;
+
+	if (format == Rgb888Layout::Format())
+		return PackPixels<Rgb888Layout>;
+
+	if (format == Bgr888Layout::Format())
+		return PackPixels<Bgr888Layout>;
+
+	if (format == Rgb666Layout::Format())
+		return PackPixels<Rgb666Layout>;
+
+	if (format == Xrgb8888Layout::Format())
+		return PackPixels<Xrgb8888Layout>;
+
+	if (format == Xbgr8888Layout::Format())
+		return PackPixels<Xbgr8888Layout>;
+
+	return PackPixelsBitfields;
+}
+
+
+static void BuildSamplingTable(int sourceStart, int sourceLength, int destinationLength,
+	std::vector<int>& index, std::vector<unsigned int>& weight)
+{
+	index.resize(destinationLength);
+	weight.resize(destinationLength);
+
+	double scale = (double)sourceLength / (double)destinationLength;
+
+	for (int i = 0; i < destinationLength; ++i)
+	{
+		// Sample at pixel centers
+		double position = (i + 0.5) * scale - 0.5;
+		if (position < 0)
+			position = 0;
+
+		int integer = (int)position;
+		unsigned int fraction = (unsigned int)((position - integer) * WEIGHT_ONE + 0.5);
+
+		if (fraction >= WEIGHT_ONE)
+		{
+			++integer;
+			fraction = 0;
+		}
+
+		if (integer >= sourceLength - 1)
+		{
+			integer = sourceLength - 1;
+			fraction = 0;
+		}
+
+		index[i] = sourceStart + integer;
+		weight[i] = fraction;
+	}
+}
+
+
+SoftwareConverter::SoftwareConverter(int sourceWidth, int sourceHeight, const PixelFormat& sourceFormat,
+	int width, int height, const PixelFormat& format, const Rectangle& destination,
+	SimdLevel simd, int bufferCount, const Transform& transform)
+	: sourceWidth(sourceWidth), sourceHeight(sourceHeight), sourceFormat(sourceFormat),
+	width(width), height(height), format(format), destination(destination), transform(transform),
+	simd(simd), bufferCount(bufferCount)
+{
+	if (sourceWidth < 1 || sourceHeight < 1)
+		throw Exception("invalid source size");
+
+	if (!sourceFormat.IsSupported())
+		throw Exception("fb0 pixel format not supported");
+
+	if (!format.IsSupported())
+		throw Exception("output pixel format not supported");
+
+	// The destination is in the logical image
+	int logicalWidth = transform.SwapsAxes() ? height : width;
+	int logicalHeight = transform.SwapsAxes() ? width : height;
+
+	if (destination.X < 0 || destination.Y < 0 ||
+		destination.Width < 1 || destination.Height < 1 ||
+		destination.X + destination.Width > logicalWidth ||
+		destination.Y + destination.Height > logicalHeight)
+	{
+		throw Exception("invalid destination rectangle");
+	}
+
+	if (transform.Rotation != 0 && transform.Rotation != 90 &&
+		transform.Rotation != 180 && transform.Rotation != 270)
+	{
+		throw Exception("invalid rotation");
+	}
+
+	if (!IsSupported(simd))
+		throw Exception("SIMD level not supported");
+
+	if (bufferCount < 1)
+		throw Exception("bufferCount < 1");
+
+
+	sourceStride = sourceWidth * sourceFormat.BytesPerPixel();
+	bytesPerPixel = format.BytesPerPixel();
+
+	directRows = sourceFormat == Xrgb8888Layout::Format();
+	unpackPixels = SelectUnpackPixels(sourceFormat);
+	packPixels = SelectPackPixels(format);
+
+	switch (simd)
+	{
+#if defined(HAVE_SSE2)
+		case SimdLevel::Sse2:
+			blendRows = BlendRowsSse2;
+			blendOverlay = BlendOverlaySse2;
+			packRow = PackRowSse2;
+			break;
+#endif
+
+#if defined(HAVE_AVX2)
+		case SimdLevel::Avx2:
+			blendRows = BlendRowsAvx2;
+			blendOverlay = BlendOverlayAvx2;
+			packRow = PackRowAvx2;
+			break;
+#endif
+
+#if defined(HAVE_NEON)
+		case SimdLevel::Neon:
+			blendRows = BlendRowsNeon;
+			blendOverlay = BlendOverlayNeon;
+			packRow = PackRowNeon;
+			break;
+#endif
+
+		default:
+			blendRows = BlendRowsScalar;
+			blendOverlay = BlendOverlayScalar;
+			packRow = PackRowScalar;
+			break;
+	}
+
+	if (format != Rgb565Layout::Format())
+		packRow = nullptr;
+
+
+	outputLength = (size_t)width * height * bytesPerPixel;
+
+	if (posix_memalign((void**)&output, 64, outputLength * bufferCount) != 0)
+		throw Exception("posix_memalign failed.");
+
+	memset(output, 0, outputLength * bufferCount);
+
+
+	Rectangle whole = { 0, 0, sourceWidth, sourceHeight };
+	SetSourceRect(whole);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		unpacked[i].resize(sourceWidth);
+		unpackedY[i] = -1;
+	}
+
+	blended.resize(sourceWidth);
+	sampled.resize(destination.Width);
+	packed.resize(destination.Width * bytesPerPixel);
+
+
+	// Every logical pixel moves by a constant output offset per column
+	// and per row, so the three corners of the mapped destination give
+	// the whole mapping.
+	Rectangle origin = transform.Map({ destination.X, destination.Y, 1, 1 }, width, height);
+	Rectangle right = transform.Map({ destination.X + 1, destination.Y, 1, 1 }, width, height);
+	Rectangle down = transform.Map({ destination.X, destination.Y + 1, 1, 1 }, width, height);
+
+	outputOrigin = (ptrdiff_t)origin.Y * width + origin.X;
+	columnStep = ((ptrdiff_t)right.Y * width + right.X) - outputOrigin;
+	rowStep = ((ptrdiff_t)down.Y * width + down.X) - outputOrigin;
+}
+
+SoftwareConverter::~SoftwareConverter()
+{
+	free(output);
+}
+
+
+const char* SoftwareConverter::Name() const
+{
+	switch (simd)
+	{
+		case SimdLevel::Sse2:
+			return "cpu-sse2";
+
+		case SimdLevel::Avx2:
+			return "cpu-avx2";
+
+		case SimdLevel::Neon:
+			return "cpu-neon";
+
+		default:
+			return "cpu-scalar";
+	}
+}
+
+
+SimdLevel SoftwareConverter::DetectSimd()
+{
+#if defined(HAVE_NEON)
+	return SimdLevel::Neon;
+#else
+
+#if defined(HAVE_AVX2)
+	if (__builtin_cpu_supports("avx2"))
+		return SimdLevel::Avx2;
+#endif
+
+#if defined(HAVE_SSE2)
+	return SimdLevel::Sse2;
+#else
+	return SimdLevel::Scalar;
+#endif
+
+#endif
+}
+
+bool SoftwareConverter::IsSupported(SimdLevel simd)
+{
+	switch (simd)
+	{
+		case SimdLevel::Scalar:
+			return true;
+
+#if defined(HAVE_SSE2)
+		case SimdLevel::Sse2:
+			return true;
+#endif
+
+#if defined(HAVE_AVX2)
+		case SimdLevel::Avx2:
+			return __builtin_cpu_supports("avx2");
+#endif
+
+#if defined(HAVE_NEON)
+		case SimdLevel::Neon:
+			return true;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+const char* SoftwareConverter::SimdName(SimdLevel simd)
+{
+	switch (simd)
+	{
+		case SimdLevel::Sse2:
+			return "sse2";
+
+		case SimdLevel::Avx2:
+			return "avx2";
+
+		case SimdLevel::Neon:
+			return "neon";
+
+		default:
+			return "scalar";
+	}
+}
+
+
+void SoftwareConverter::SetSourceRect(const Rectangle& rect)
+{
+	if (rect.X < 0 || rect.Y < 0 || rect.Width < 1 || rect.Height < 1 ||
+		rect.X + rect.Width > sourceWidth || rect.Y + rect.Height > sourceHeight)
+	{
+		throw Exception("invalid source rectangle");
+	}
+
+	sourceRect = rect;
+
+	BuildSamplingTable(rect.X, rect.Width, destination.Width, xIndex, xWeight);
+	BuildSamplingTable(rect.Y, rect.Height, destination.Height, yIndex, yWeight);
+
+	UpdateOverlayExtent();
+}
+
+void SoftwareConverter::SetOverlay(const void* data, int width, int height, int stride)
+{
+	bool resized = (width != overlayWidth || height != overlayHeight);
+
+	overlayData = data;
+	overlayWidth = width;
+	overlayHeight = height;
+	overlayStride = stride ? stride : width * 4;
+
+	if (resized)
+		UpdateOverlayExtent();
+}
+
+void SoftwareConverter::UpdateOverlayExtent()
+{
+	// The sampling positions only grow, so the columns and rows that fall
+	// on the overlay are a prefix of the destination
+	overlayColumns = 0;
+	while (overlayColumns < destination.Width && xIndex[overlayColumns] < overlayWidth)
+	{
+		++overlayColumns;
+	}
+
+	overlayRows = 0;
+	while (overlayRows < destination.Height && yIndex[overlayRows] < overlayHeight)
+	{
+		++overlayRows;
+	}
+
+	overlaySampled.resize(overlayColumns);
+}
+
+
+const unsigned int* SoftwareConverter::SourceRow(int y)
+{
+	const unsigned char* row = (const unsigned char*)sourceData + (size_t)y * sourceStride;
+
+	if (directRows)
+	{
+		return (const unsigned int*)row;
+	}
+
+
+	// Other rows are expanded to XRGB8888 once and reused by consecutive
+	// destination rows.
+	for (int i = 0; i < 2; ++i)
+	{
+		if (unpackedY[i] == y)
+			return unpacked[i].data();
+	}
+
+	int slot = (unpackedY[0] < unpackedY[1]) ? 0 : 1;
+	unsigned int* dst = unpacked[slot].data();
+
+	// Only the columns of the source rectangle are sampled
+	unpackPixels(dst, row, sourceRect.X, sourceRect.X + sourceRect.Width, sourceFormat);
+
+	unpackedY[slot] = y;
+
+	return dst;
+}
+
+void SoftwareConverter::Convert(int index)
+{
+	TraceScope trace("cpu convert", "cpu", index);
+
+	if (sourceData == nullptr)
+		throw InvalidOperationException();
+
+	if (index < 0 || index >= bufferCount)
+		throw Exception("invalid buffer index");
+
+	unsigned char* target = (unsigned char*)Output(index);
+
+
+	// Force rows to be unpacked again; the source changes every frame.
+	unpackedY[0] = -1;
+	unpackedY[1] = -1;
+
+	for (int y = 0; y < destination.Height; ++y)
+	{
+		// Vertical pass
+		int sy = yIndex[y];
+		unsigned int fy = yWeight[y];
+
+		const unsigned int* row;
+		if (fy == 0)
+		{
+			row = SourceRow(sy);
+		}
+		else
+		{
+			const unsigned int* a = SourceRow(sy);
+			const unsigned int* b = SourceRow(sy + 1);
+
+			int x0 = sourceRect.X;
+			blendRows(blended.data() + x0, a + x0, b + x0, sourceRect.Width, fy);
+			row = blended.data();
+		}
+
+
+		// Horizontal pass
+		unsigned int* dst = sampled.data();
+		for (int x = 0; x < destination.Width; ++x)
+		{
+			int sx = xIndex[x];
+			unsigned int fx = xWeight[x];
+
+			dst[x] = (fx == 0) ? row[sx] : LerpPixel(row[sx], row[sx + 1], fx);
+		}
+
+
+		// Overlay, nearest sampled; rows it leaves fully transparent are
+		// not blended
+		if (overlayData && y < overlayRows)
+		{
+			const unsigned int* overlayRow = (const unsigned int*)((const unsigned char*)overlayData +
+				(size_t)yIndex[y] * overlayStride);
+
+			unsigned int* over = overlaySampled.data();
+			unsigned int alpha = 0;
+
+			for (int x = 0; x < overlayColumns; ++x)
+			{
+				over[x] = overlayRow[xIndex[x]];
+				alpha |= over[x];
+			}
+
+			if (alpha >> 24)
+				blendOverlay(dst, over, overlayColumns);
+		}
+
+
+		unsigned char* out = target + (outputOrigin + y * rowStep) * bytesPerPixel;
+		unsigned char* pixels = (columnStep == 1) ? out : packed.data();
+
+		if (packRow)
+			packRow((unsigned short*)pixels, dst, destination.Width);
+		else
+			packPixels(pixels, dst, destination.Width, format);
+
+		if (columnStep != 1)
+		{
+			// Rotated or mirrored rows are scattered after packing
+			ptrdiff_t step = columnStep * bytesPerPixel;
+
+			for (int x = 0; x < destination.Width; ++x)
+			{
+				memcpy(out + x * step, pixels + x * bytesPerPixel, bytesPerPixel);
+			}
+		}
+	}
+}
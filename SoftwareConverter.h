@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+
+#include "Converter.h"
+#include "PixelFormat.h"
+
+
+enum class SimdLevel
+{
+	Scalar = 0,
+	Sse2,
+	Avx2,
+	Neon
+};
+
+
+// CPU equivalent of GE2D_STRETCHBLIT_NOALPHA: bilinear scaling of a
+// 16/24/32 bpp source into a 16/24/32 bpp buffer, rotated and flipped as
+// the transform asks. Both formats follow their fbdev channel offsets;
+// the common layouts have their own compile time specialized row
+// functions and anything else goes through the bitfields.
+//
+// An ARGB8888 overlay (OSD1) can be alpha blended over the scaled rows
+// before they are packed, the CPU side of the GE2D_BLEND pass.
+class SoftwareConverter : public Converter
+{
+	typedef void (*BlendRowsFunc)(unsigned int* dst, const unsigned int* a, const unsigned int* b, int count, unsigned int weight);
+	typedef void (*BlendOverlayFunc)(unsigned int* dst, const unsigned int* overlay, int count);
+	typedef void (*PackRowFunc)(unsigned short* dst, const unsigned int* src, int count);
+	typedef void (*UnpackPixelsFunc)(unsigned int* dst, const unsigned char* src, int start, int end, const PixelFormat& format);
+	typedef void (*PackPixelsFunc)(unsigned char* dst, const unsigned int* src, int count, const PixelFormat& format);
+
+	int sourceWidth;
+	int sourceHeight;
+	PixelFormat sourceFormat;
+	int sourceStride;
+	const void* sourceData = nullptr;
+
+	int width;
+	int height;
+	PixelFormat format;
+	int bytesPerPixel;
+	Rectangle destination;
+	Rectangle sourceRect;
+	Transform transform;
+
+	// Output offset of the first pixel of logical destination row 0, and
+	// how far it moves per logical column and row.
+	ptrdiff_t outputOrigin;
+	ptrdiff_t columnStep;
+	ptrdiff_t rowStep;
+
+	SimdLevel simd;
+	BlendRowsFunc blendRows;
+	BlendOverlayFunc blendOverlay;
+
+	// ARGB8888 image over the source origin, and the destination columns
+	// and rows that sample it
+	const void* overlayData = nullptr;
+	int overlayWidth = 0;
+	int overlayHeight = 0;
+	int overlayStride = 0;
+	int overlayColumns = 0;
+	int overlayRows = 0;
+
+	// Rows of XRGB8888 are sampled in place, everything else is unpacked
+	bool directRows;
+	UnpackPixelsFunc unpackPixels;
+
+	// RGB565 has SIMD packing, other formats are packed per pixel
+	PackRowFunc packRow;
+	PackPixelsFunc packPixels;
+
+	int bufferCount;
+	unsigned char* output = nullptr;
+	size_t outputLength;
+
+	// Fixed point (7 bit) sampling positions for each destination pixel
+	std::vector<int> xIndex;
+	std::vector<unsigned int> xWeight;
+	std::vector<int> yIndex;
+	std::vector<unsigned int> yWeight;
+
+	// Scratch rows
+	std::vector<unsigned int> unpacked[2];
+	int unpackedY[2];
+	std::vector<unsigned int> blended;
+	std::vector<unsigned int> sampled;
+	std::vector<unsigned char> packed;
+	std::vector<unsigned int> overlaySampled;
+
+
+	const unsigned int* SourceRow(int y);
+	void UpdateOverlayExtent();
+
+	static UnpackPixelsFunc SelectUnpackPixels(const PixelFormat& format);
+	static PackPixelsFunc SelectPackPixels(const PixelFormat& format);
+
+
+public:
+
+	virtual const char* Name() const override;
+
+	virtual int BufferCount() const override
+	{
+		return bufferCount;
+	}
+
+	virtual void* Output(int index) const override
+	{
+		return output + index * outputLength;
+	}
+
+	virtual size_t OutputLength() const override
+	{
+		return outputLength;
+	}
+
+	SimdLevel Simd() const
+	{
+		return simd;
+	}
+
+
+	SoftwareConverter(int sourceWidth, int sourceHeight, const PixelFormat& sourceFormat,
+		int width, int height, const PixelFormat& format, const Rectangle& destination,
+		SimdLevel simd, int bufferCount = 1, const Transform& transform = Transform());
+	virtual ~SoftwareConverter();
+
+
+	static SimdLevel DetectSimd();
+	static bool IsSupported(SimdLevel simd);
+	static const char* SimdName(SimdLevel simd);
+
+
+	// stride is the distance between source rows, 0 for packed rows
+	void SetSource(const void* data, int stride = 0)
+	{
+		sourceData = data;
+		sourceStride = stride ? stride : sourceWidth * sourceFormat.BytesPerPixel();
+	}
+
+	virtual void SetSourceRect(const Rectangle& rect) override;
+
+	// Lays a width x height ARGB8888 image (OSD1) over the source at its
+	// origin. It is scaled with the source, nearest sampled, and blended
+	// by its alpha. stride 0 is packed rows; nullptr removes it.
+	void SetOverlay(const void* data, int width, int height, int stride = 0);
+
+	// SetSource already points at the displayed page
+	virtual void SetSourceOffset(int x, int y) override
+	{
+	}
+
+	// Conversion is synchronous
+	virtual void Convert(int index) override;
+
+	virtual void Wait() override
+	{
+	}
+};
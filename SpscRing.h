@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "Exception.h"
+
+
+// Bounded single producer / single consumer ring without locks. When the
+// ring is full the producer evicts the oldest item instead of blocking, so
+// the consumer always sees the most recent items.
+//
+// Eviction moves the tail from the producer side, so both ends advance
+// the tail with a compare-and-swap. A consumer that loses that race only
+// discards its copy of the item. The producer may already be writing the
+// next item into that slot, so slots are copied as relaxed atomic words:
+// the copy can be torn, but it is never used, and the accesses are not a
+// data race.
+template <typename T>
+class SpscRing
+{
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+	static const size_t WORDS = (sizeof(T) + sizeof(unsigned long) - 1) / sizeof(unsigned long);
+
+	struct Slot
+	{
+		std::atomic<unsigned long> Words[WORDS];
+	};
+
+	std::vector<Slot> slots;
+	size_t capacity;
+
+	// Written by the producer only
+	std::atomic<size_t> head;
+
+	// Advanced by the consumer, and by the producer when it evicts
+	std::atomic<size_t> tail;
+
+
+	void Store(size_t index, const T& item)
+	{
+		unsigned long words[WORDS] = { 0 };
+		memcpy(words, &item, sizeof(T));
+
+		Slot& slot = slots[index % capacity];
+		for (size_t i = 0; i < WORDS; ++i)
+		{
+			slot.Words[i].store(words[i], std::memory_order_relaxed);
+		}
+	}
+
+	T Load(size_t index) const
+	{
+		unsigned long words[WORDS];
+
+		const Slot& slot = slots[index % capacity];
+		for (size_t i = 0; i < WORDS; ++i)
+		{
+			words[i] = slot.Words[i].load(std::memory_order_relaxed);
+		}
+
+		T result;
+		memcpy(&result, words, sizeof(T));
+
+		return result;
+	}
+
+
+public:
+
+	size_t Capacity() const
+	{
+		return capacity;
+	}
+
+	size_t Size() const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+
+	SpscRing(size_t capacity)
+		: slots(capacity), capacity(capacity), head(0), tail(0)
+	{
+		if (capacity < 1)
+			throw Exception("capacity < 1");
+	}
+
+
+	// Producer. Returns false when the ring was full and the oldest item
+	// was evicted; it is stored in evicted when that is not null.
+	bool Push(const T& item, T* evicted)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		bool result = true;
+
+		while (true)
+		{
+			size_t t = tail.load(std::memory_order_acquire);
+			if (h - t < capacity)
+				break;
+
+			T oldest = Load(t);
+			if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel))
+			{
+				if (evicted)
+					*evicted = oldest;
+
+				result = false;
+				break;
+			}
+		}
+
+		Store(h, item);
+		head.store(h + 1, std::memory_order_release);
+
+		return result;
+	}
+
+	// Consumer. Returns false when the ring is empty.
+	bool Pop(T* item)
+	{
+		size_t t = tail.load(std::memory_order_acquire);
+
+		while (true)
+		{
+			if (t == head.load(std::memory_order_acquire))
+				return false;
+
+			T value = Load(t);
+			if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel))
+			{
+				*item = value;
+				return true;
+			}
+		}
+	}
+};
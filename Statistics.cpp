@@ -0,0 +1,76 @@
+#include "Statistics.h"
+
+#include <algorithm>
+
+#include "Exception.h"
+
+
+Statistics::Statistics(size_t window)
+{
+	if (window < 1)
+		throw Exception("window < 1");
+
+	samples.resize(window);
+}
+
+
+void Statistics::Add(double value)
+{
+	if (count == samples.size())
+	{
+		sum -= samples[next];
+	}
+	else
+	{
+		++count;
+	}
+
+	samples[next] = value;
+	sum += value;
+
+	next = (next + 1) % samples.size();
+}
+
+void Statistics::Reset()
+{
+	next = 0;
+	count = 0;
+	sum = 0;
+}
+
+
+double Statistics::Mean() const
+{
+	return count ? sum / count : 0.0;
+}
+
+double Statistics::Min() const
+{
+	if (count == 0)
+		return 0.0;
+
+	return *std::min_element(samples.begin(), samples.begin() + count);
+}
+
+double Statistics::Max() const
+{
+	if (count == 0)
+		return 0.0;
+
+	return *std::max_element(samples.begin(), samples.begin() + count);
+}
+
+double Statistics::Percentile(double p) const
+{
+	if (count == 0)
+		return 0.0;
+
+	std::vector<double> sorted(samples.begin(), samples.begin() + count);
+	std::sort(sorted.begin(), sorted.end());
+
+	size_t index = (size_t)(p * (count - 1) + 0.5);
+	if (index >= count)
+		index = count - 1;
+
+	return sorted[index];
+}
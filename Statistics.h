@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+// Running statistics over a fixed window of the most recent samples.
+// The sample storage is allocated once so Add never allocates.
+class Statistics
+{
+	std::vector<double> samples;
+	size_t next = 0;
+	size_t count = 0;
+	double sum = 0;
+
+
+public:
+
+	size_t Count() const
+	{
+		return count;
+	}
+
+
+	Statistics(size_t window = 1024);
+
+
+	void Add(double value);
+	void Reset();
+
+	double Mean() const;
+	double Min() const;
+	double Max() const;
+
+	// p in [0, 1]
+	double Percentile(double p) const;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <time.h>
+
+
+// Monotonic time in seconds
+inline double GetTime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,192 @@
+#include "Tracer.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "Exception.h"
+
+
+bool Tracer::enabled = false;
+
+
+Tracer& Tracer::Instance()
+{
+	static Tracer instance;
+	return instance;
+}
+
+
+Tracer::Tracer()
+	: next(0)
+{
+}
+
+Tracer::~Tracer()
+{
+	enabled = false;
+	delete[] events;
+}
+
+
+int Tracer::CurrentThread()
+{
+	static thread_local int thread = (int)syscall(SYS_gettid);
+	return thread;
+}
+
+
+void Tracer::Enable(size_t capacity)
+{
+	if (events)
+		throw Exception("tracing already enabled");
+
+	size_t size = 1;
+	while (size < capacity)
+	{
+		size *= 2;
+	}
+
+	events = new Event[size];
+	for (size_t i = 0; i < size; ++i)
+	{
+		events[i].Sequence.store(0, std::memory_order_relaxed);
+	}
+
+	mask = size - 1;
+	origin = GetTime();
+	enabled = true;
+
+	NameThread("main");
+}
+
+void Tracer::NameThread(const std::string& name)
+{
+	if (!enabled)
+		return;
+
+	std::lock_guard<std::mutex> lock(namesMutex);
+
+	ThreadName entry;
+	entry.Thread = CurrentThread();
+	entry.Name = name;
+
+	threadNames.push_back(entry);
+}
+
+
+void Tracer::Record(const char* name, const char* category, double begin, double end, int arg)
+{
+	if (!enabled)
+		return;
+
+	unsigned long long index = next.fetch_add(1, std::memory_order_relaxed);
+	Event& event = events[index & mask];
+
+	// A reader seeing 0, or a sequence that changed while it copied the
+	// slot, skips it
+	event.Sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	event.Name = name;
+	event.Category = category;
+	event.Begin = begin;
+	event.End = end;
+	event.Thread = CurrentThread();
+	event.Arg = arg;
+
+	event.Sequence.store(index + 1, std::memory_order_release);
+}
+
+
+static void WriteString(FILE* file, const char* text)
+{
+	fputc('"', file);
+
+	for (const char* p = text; *p; ++p)
+	{
+		if (*p == '"' || *p == '\\')
+			fputc('\\', file);
+
+		if ((unsigned char)*p >= 0x20)
+			fputc(*p, file);
+	}
+
+	fputc('"', file);
+}
+
+bool Tracer::Write(const char* path)
+{
+	if (!enabled)
+		return false;
+
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "trace: can not write %s\n", path);
+		return false;
+	}
+
+	int pid = getpid();
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	{
+		std::lock_guard<std::mutex> lock(namesMutex);
+
+		for (size_t i = 0; i < threadNames.size(); ++i)
+		{
+			fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+				i ? ",\n" : "", pid, threadNames[i].Thread);
+			WriteString(file, threadNames[i].Name.c_str());
+			fprintf(file, "}}");
+		}
+	}
+
+	bool first = threadNames.empty();
+
+	unsigned long long end = next.load(std::memory_order_acquire);
+	unsigned long long start = (end > mask + 1) ? end - (mask + 1) : 0;
+	size_t count = 0;
+
+	for (unsigned long long index = start; index < end; ++index)
+	{
+		const Event& slot = events[index & mask];
+
+		unsigned long long sequence = slot.Sequence.load(std::memory_order_acquire);
+
+		const char* name = slot.Name;
+		const char* category = slot.Category;
+		double begin = slot.Begin;
+		double finish = slot.End;
+		int thread = slot.Thread;
+		int arg = slot.Arg;
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence != index + 1 || slot.Sequence.load(std::memory_order_relaxed) != sequence)
+			continue;
+
+		fprintf(file, "%s{\"ph\":\"X\",\"name\":", first ? "" : ",\n");
+		WriteString(file, name);
+		fprintf(file, ",\"cat\":");
+		WriteString(file, category);
+		fprintf(file, ",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+			pid, thread, (begin - origin) * 1e6, (finish - begin) * 1e6);
+
+		if (arg >= 0)
+			fprintf(file, ",\"args\":{\"buffer\":%d}", arg);
+
+		fprintf(file, "}");
+
+		first = false;
+		++count;
+	}
+
+	fprintf(file, "\n]}\n");
+
+	bool ok = (fclose(file) == 0);
+
+	printf("trace: %zu spans written to %s\n", count, path);
+
+	return ok;
+}
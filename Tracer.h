@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Timing.h"
+
+
+// Records timed spans (vsync waits, blits, copies) into a ring allocated
+// when tracing is enabled and writes them out as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev load. Recording takes no lock and
+// does no allocation or I/O; when the ring is full the oldest spans are
+// overwritten.
+class Tracer
+{
+	struct Event
+	{
+		// Index + 1 of the span in the slot, 0 while it is being written
+		std::atomic<unsigned long long> Sequence;
+		const char* Name;
+		const char* Category;
+		double Begin;
+		double End;
+		int Thread;
+		int Arg;
+	};
+
+	struct ThreadName
+	{
+		int Thread;
+		std::string Name;
+	};
+
+
+	static bool enabled;
+
+	Event* events = nullptr;
+	size_t mask = 0;
+	std::atomic<unsigned long long> next;
+	double origin = 0;
+
+	std::mutex namesMutex;
+	std::vector<ThreadName> threadNames;
+
+
+	Tracer();
+
+	static int CurrentThread();
+
+
+public:
+
+	static const size_t DEFAULT_CAPACITY = 65536;
+
+
+	static Tracer& Instance();
+
+	static bool IsEnabled()
+	{
+		return enabled;
+	}
+
+
+	~Tracer();
+
+	Tracer(const Tracer&) = delete;
+	Tracer& operator=(const Tracer&) = delete;
+
+
+	// Allocates a ring of capacity spans, rounded up to a power of two.
+	// Must be called before the threads that record are started.
+	void Enable(size_t capacity = DEFAULT_CAPACITY);
+
+	// Labels the calling thread in the trace
+	void NameThread(const std::string& name);
+
+	// name and category must outlive the tracer; string literals or the
+	// device names of framebuffers. arg is shown when it is not negative.
+	void Record(const char* name, const char* category, double begin, double end, int arg = -1);
+
+	// Writes the spans in the ring. Recording may continue meanwhile;
+	// spans overwritten during the write are left out.
+	bool Write(const char* path);
+};
+
+
+// Records the lifetime of the scope as a span when tracing is enabled
+class TraceScope
+{
+	const char* name;
+	const char* category;
+	int arg;
+	double begin;
+
+
+public:
+
+	TraceScope(const char* name, const char* category = "", int arg = -1)
+		: name(name), category(category), arg(arg), begin(Tracer::IsEnabled() ? GetTime() : 0)
+	{
+	}
+
+	~TraceScope()
+	{
+		if (begin > 0)
+			Tracer::Instance().Record(name, category, begin, GetTime(), arg);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+};
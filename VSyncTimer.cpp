@@ -0,0 +1,46 @@
+#include "VSyncTimer.h"
+
+#include <errno.h>
+#include <time.h>
+
+#include "Timing.h"
+#include "Exception.h"
+
+
+VSyncTimer::VSyncTimer(double refreshRate)
+{
+	if (refreshRate < 0)
+		throw Exception("refreshRate < 0");
+
+	// A rate of zero does not wait at all
+	period = (refreshRate > 0) ? 1.0 / refreshRate : 0;
+}
+
+
+void VSyncTimer::Wait()
+{
+	if (period == 0)
+		return;
+
+	double now = GetTime();
+
+	if (next == 0 || now - next > period)
+	{
+		// First call or too far behind; restart the cadence instead of
+		// returning immediately for every missed interval.
+		next = now + period;
+	}
+	else
+	{
+		next += period;
+	}
+
+
+	timespec ts;
+	ts.tv_sec = (time_t)next;
+	ts.tv_nsec = (long)((next - ts.tv_sec) * 1e9);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+	{
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+
+// Simulated vsync for framebuffers that have no vsync interrupt.
+class VSyncTimer
+{
+	double period;
+	double next = 0;
+
+
+public:
+
+	double RefreshRate() const
+	{
+		return (period > 0) ? 1.0 / period : 0;
+	}
+
+
+	VSyncTimer(double refreshRate);
+
+
+	void Wait();
+};
@@ -0,0 +1,257 @@
+#include "Viewport.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Exception.h"
+
+
+Viewport::Viewport(int sourceWidth, int sourceHeight)
+	: sourceWidth(sourceWidth), sourceHeight(sourceHeight)
+{
+	rect.X = 0;
+	rect.Y = 0;
+	rect.Width = sourceWidth;
+	rect.Height = sourceHeight;
+
+	pointerX = sourceWidth / 2;
+	pointerY = sourceHeight / 2;
+}
+
+Viewport::~Viewport()
+{
+	if (socketFd >= 0)
+	{
+		close(socketFd);
+		unlink(socketPath.c_str());
+	}
+
+	if (mouseFd >= 0)
+	{
+		close(mouseFd);
+	}
+}
+
+
+Rectangle Viewport::ParseRect(const char* value)
+{
+	Rectangle result;
+	if (sscanf(value, "%d,%d,%d,%d", &result.X, &result.Y, &result.Width, &result.Height) != 4)
+	{
+		throw Exception("invalid rectangle");
+	}
+
+	return result;
+}
+
+
+void Viewport::SetRect(int x, int y, int width, int height)
+{
+	// Keep the rectangle inside the source
+	if (width > sourceWidth)
+		width = sourceWidth;
+	if (height > sourceHeight)
+		height = sourceHeight;
+	if (width < 1)
+		width = 1;
+	if (height < 1)
+		height = 1;
+
+	if (x < 0)
+		x = 0;
+	if (y < 0)
+		y = 0;
+	if (x + width > sourceWidth)
+		x = sourceWidth - width;
+	if (y + height > sourceHeight)
+		y = sourceHeight - height;
+
+	if (x != rect.X || y != rect.Y || width != rect.Width || height != rect.Height)
+	{
+		rect.X = x;
+		rect.Y = y;
+		rect.Width = width;
+		rect.Height = height;
+
+		changed = true;
+	}
+}
+
+void Viewport::SetSourceSize(int width, int height)
+{
+	bool whole = rect.X == 0 && rect.Y == 0 && rect.Width == sourceWidth && rect.Height == sourceHeight;
+
+	sourceWidth = width;
+	sourceHeight = height;
+
+	if (whole)
+		SetRect(0, 0, width, height);
+	else
+		SetRect(rect.X, rect.Y, rect.Width, rect.Height);
+
+	if (pointerX >= width)
+		pointerX = width - 1;
+	if (pointerY >= height)
+		pointerY = height - 1;
+}
+
+void Viewport::Select(const Rectangle& value)
+{
+	SetRect(value.X, value.Y, value.Width, value.Height);
+}
+
+void Viewport::Zoom(double zoom)
+{
+	if (zoom < 1)
+		zoom = 1;
+
+	int width = sourceWidth / zoom;
+	int height = sourceHeight / zoom;
+
+	int centerX = rect.X + rect.Width / 2;
+	int centerY = rect.Y + rect.Height / 2;
+
+	SetRect(centerX - width / 2, centerY - height / 2, width, height);
+}
+
+
+void Viewport::OpenControlSocket(const char* path)
+{
+	sockaddr_un address = { 0 };
+	address.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+		throw Exception("control socket path too long");
+
+	strcpy(address.sun_path, path);
+
+	socketFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (socketFd < 0)
+	{
+		throw Exception("socket failed.");
+	}
+
+	// A socket left behind by a previous run
+	unlink(path);
+
+	if (bind(socketFd, (sockaddr*)&address, sizeof(address)) < 0)
+	{
+		throw Exception("bind control socket failed.");
+	}
+
+	socketPath = path;
+
+	printf("viewport: control socket %s\n", path);
+}
+
+void Viewport::FollowMouse(const char* device)
+{
+	mouseFd = open(device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (mouseFd < 0)
+	{
+		throw Exception("open mouse failed.");
+	}
+
+	printf("viewport: following %s\n", device);
+}
+
+
+void Viewport::HandleCommand(const char* command)
+{
+	int x;
+	int y;
+	int width;
+	int height;
+	double zoom;
+
+	if (sscanf(command, "roi %d %d %d %d", &x, &y, &width, &height) == 4)
+		SetRect(x, y, width, height);
+	else if (sscanf(command, "move %d %d", &x, &y) == 2)
+		SetRect(x, y, rect.Width, rect.Height);
+	else if (sscanf(command, "pan %d %d", &x, &y) == 2)
+		SetRect(rect.X + x, rect.Y + y, rect.Width, rect.Height);
+	else if (sscanf(command, "center %d %d", &x, &y) == 2)
+		SetRect(x - rect.Width / 2, y - rect.Height / 2, rect.Width, rect.Height);
+	else if (sscanf(command, "zoom %lf", &zoom) == 1)
+		Zoom(zoom);
+	else if (strncmp(command, "reset", 5) == 0)
+		SetRect(0, 0, sourceWidth, sourceHeight);
+	else
+		fprintf(stderr, "viewport: unknown command '%s'\n", command);
+}
+
+void Viewport::HandleMouse(int dx, int dy)
+{
+	// The pointer is tracked from relative motion, so it can drift from
+	// the real cursor; clamping at the screen edges brings it back.
+	pointerX += dx;
+	pointerY += dy;
+
+	if (pointerX < 0)
+		pointerX = 0;
+	if (pointerY < 0)
+		pointerY = 0;
+	if (pointerX >= sourceWidth)
+		pointerX = sourceWidth - 1;
+	if (pointerY >= sourceHeight)
+		pointerY = sourceHeight - 1;
+
+
+	// Push the rectangle when the pointer gets close to one of its edges
+	int marginX = rect.Width / 8;
+	int marginY = rect.Height / 8;
+
+	int x = rect.X;
+	int y = rect.Y;
+
+	if (pointerX < x + marginX)
+		x = pointerX - marginX;
+	else if (pointerX >= x + rect.Width - marginX)
+		x = pointerX - rect.Width + marginX + 1;
+
+	if (pointerY < y + marginY)
+		y = pointerY - marginY;
+	else if (pointerY >= y + rect.Height - marginY)
+		y = pointerY - rect.Height + marginY + 1;
+
+	SetRect(x, y, rect.Width, rect.Height);
+}
+
+
+bool Viewport::Poll()
+{
+	if (socketFd >= 0)
+	{
+		char command[128];
+
+		while (true)
+		{
+			ssize_t count = recv(socketFd, command, sizeof(command) - 1, 0);
+			if (count < 0)
+				break;
+
+			command[count] = 0;
+			HandleCommand(command);
+		}
+	}
+
+	if (mouseFd >= 0)
+	{
+		// PS/2 packets: flags, dx, dy (up is positive)
+		signed char packet[3];
+
+		while (read(mouseFd, packet, sizeof(packet)) == sizeof(packet))
+		{
+			HandleMouse(packet[1], -packet[2]);
+		}
+	}
+
+	bool result = changed;
+	changed = false;
+
+	return result;
+}
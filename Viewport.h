@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+
+#include "Converter.h"
+
+
+// The region of the source that is mirrored. It can be changed at runtime
+// with text commands on a Unix datagram socket and can follow the mouse.
+//
+// Commands:
+//   roi X Y W H        select a rectangle
+//   move X Y           move the top left corner
+//   pan DX DY          move by an offset
+//   center X Y         center on a point
+//   zoom Z             Z times magnification of the whole source, same center
+//   reset              the whole source
+class Viewport
+{
+	int sourceWidth;
+	int sourceHeight;
+	Rectangle rect;
+	bool changed = false;
+
+	std::string socketPath;
+	int socketFd = -1;
+
+	int mouseFd = -1;
+	int pointerX = 0;
+	int pointerY = 0;
+
+
+	void SetRect(int x, int y, int width, int height);
+	void HandleCommand(const char* command);
+	void HandleMouse(int dx, int dy);
+
+
+public:
+
+	const Rectangle& Rect() const
+	{
+		return rect;
+	}
+
+	// Descriptors Poll reads, -1 when not open
+	int ControlFd() const
+	{
+		return socketFd;
+	}
+
+	int MouseFd() const
+	{
+		return mouseFd;
+	}
+
+
+	Viewport(int sourceWidth, int sourceHeight);
+	~Viewport();
+
+
+	// Parses X,Y,W,H
+	static Rectangle ParseRect(const char* value);
+
+	// The source mode changed. A region showing the whole source keeps
+	// showing all of it, others are moved inside.
+	void SetSourceSize(int width, int height);
+
+	// Same arguments as the commands
+	void Select(const Rectangle& rect);
+	void Zoom(double zoom);
+
+	void OpenControlSocket(const char* path);
+	void FollowMouse(const char* device);
+
+	// Handles pending commands and mouse motion without blocking. Returns
+	// true when Rect() changed since the last call.
+	bool Poll();
+};
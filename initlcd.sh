@@ -2,6 +2,9 @@
 sudo modprobe aml_i2c
 sudo modprobe pwm-meson
 sudo modprobe pwm-ctrl
+# fbtft rotates the portrait panel to landscape, so c2screen2lcd needs no
+# rotation. GE2D rotation (rotate=0 here, with --ge2d-rotate) is opt-in
+# until it has been verified on hardware.
 sudo modprobe fbtft_device name=flexpfb rotate=270
 sudo modprobe flexfb chip=ili9488
 sudo modprobe sx865x
@@ -7,66 +7,401 @@
 #include <stdint.h>
 #include <string.h>
 #include <getopt.h>
+#include <signal.h>
+#include <string>
+#include <vector>
 
-#include "ion.h"
-#include "meson_ion.h"
-#include "ge2d.h"
-#include "ge2d_cmd.h"
-
-#include "IonBuffer.h"
 #include "FrameBuffer.h"
+#include "Mirror.h"
+#include "MirrorGroup.h"
+#include "Viewport.h"
+#include "Benchmark.h"
+#include "AutoTuner.h"
+#include "EventLoop.h"
+#include "MetricsServer.h"
+#include "Tracer.h"
+#include "Realtime.h"
+#include "Exception.h"
 
 
 struct option longopts[] = {
 	{ "aspect",			required_argument,  NULL,          'a' },
+	{ "stats",			no_argument,		NULL,          's' },
+	{ "backend",		required_argument,  NULL,          'b' },
+	{ "bench-convert",	required_argument,  NULL,          'C' },
+	{ "depth",			required_argument,  NULL,          'd' },
+	{ "input",			required_argument,  NULL,          'i' },
+	{ "output",			required_argument,  NULL,          'o' },
+	{ "rate",			required_argument,  NULL,          'r' },
+	{ "bench",			required_argument,  NULL,          'B' },
+	{ "fps",			required_argument,  NULL,          'f' },
+	{ "no-idle",		no_argument,		NULL,          'I' },
+	{ "no-zero-copy",	no_argument,		NULL,          'Z' },
+	{ "dim",			required_argument,  NULL,          'D' },
+	{ "dim-after",		required_argument,  NULL,          'A' },
+	{ "ion-cache",		required_argument,  NULL,          'M' },
+	{ "bench-readback",	required_argument,  NULL,          'R' },
+	{ "copy",			required_argument,  NULL,          'k' },
+	{ "bench-copy",		required_argument,  NULL,          'K' },
+	{ "autotune",		no_argument,		NULL,          't' },
+	{ "retune",			no_argument,		NULL,          'U' },
+	{ "profile",		required_argument,  NULL,          'p' },
+	{ "roi",			required_argument,  NULL,          'x' },
+	{ "zoom",			required_argument,  NULL,          'z' },
+	{ "control",		required_argument,  NULL,          'L' },
+	{ "follow-mouse",	optional_argument,  NULL,          'm' },
+	{ "threaded",		no_argument,		NULL,          'T' },
+	{ "cpus",			required_argument,  NULL,          'c' },
+	{ "rotate",			required_argument,  NULL,          'O' },
+	{ "flip",			required_argument,  NULL,          'F' },
+	{ "ge2d-rotate",	no_argument,		NULL,          'G' },
+	{ "metrics",		required_argument,  NULL,          'E' },
+	{ "trace",			required_argument,  NULL,          'Y' },
+	{ "probe",			required_argument,  NULL,          'Q' },
+	{ "overlay",		optional_argument,  NULL,          'V' },
+	{ "realtime",		optional_argument,  NULL,          'X' },
+	{ "rt-priority",	required_argument,  NULL,          'W' },
 	{ 0, 0, 0, 0 }
 };
 
 
+float ParseAspect(const char* value)
+{
+	if (strchr(value, ':'))
+	{
+		unsigned int h;
+		unsigned int w;
+		if (sscanf(value, "%u:%u", &h, &w) == 2)
+		{
+			return (float)h / (float)w;
+		}
+		else
+		{
+			throw Exception("invalid aspect");
+		}
+	}
+	else
+	{
+		return atof(value);
+	}
+}
+
+int ParseRotation(const char* value)
+{
+	if (strcmp(value, "auto") == 0)
+		return -1;
+
+	int result = atoi(value);
+	if (result != 0 && result != 90 && result != 180 && result != 270)
+	{
+		throw Exception("invalid rotation");
+	}
+
+	return result;
+}
+
+// h, v or hv
+void ParseFlip(const char* value, MirrorOptions& options)
+{
+	for (const char* p = value; *p; ++p)
+	{
+		if (*p == 'h')
+			options.FlipH = true;
+		else if (*p == 'v')
+			options.FlipV = true;
+		else
+			throw Exception("invalid flip");
+	}
+}
+
+// spec[,aspect=h:w][,fps=n][,depth=n][,backend=name][,rotate=n]
+SinkConfig ParseSink(const char* value, const MirrorOptions& options)
+{
+	SinkConfig result;
+	result.Options = options;
+
+	std::string text = value;
+	size_t comma = text.find(',');
+	result.Spec = text.substr(0, comma);
+
+	while (comma != std::string::npos)
+	{
+		size_t next = text.find(',', comma + 1);
+		std::string item = text.substr(comma + 1, next == std::string::npos ? std::string::npos : next - comma - 1);
+		comma = next;
+
+		size_t equals = item.find('=');
+		if (equals == std::string::npos)
+			throw Exception("invalid output option");
+
+		std::string name = item.substr(0, equals);
+		const char* argument = item.c_str() + equals + 1;
+
+		if (name == "aspect")
+			result.Options.Aspect = ParseAspect(argument);
+		else if (name == "fps")
+			result.Options.OutputRate = (strcmp(argument, "auto") == 0) ? -1 : atof(argument);
+		else if (name == "depth")
+			result.Options.Depth = atoi(argument);
+		else if (name == "backend")
+			result.Options.Backend = argument;
+		else if (name == "rotate")
+			result.Options.Rotation = ParseRotation(argument);
+		else
+			throw Exception("unknown output option");
+	}
+
+	if (result.Options.Depth < 1)
+	{
+		throw Exception("invalid depth");
+	}
+
+	return result;
+}
+
+
 void ShowUsage()
 {
 	printf("Usage: c2screen2lcd [OPTIONS]\n");
 	printf("Displays main framebuffer on LCD shield.\n\n");
 
 	printf("  -a, --aspect h:w\tForce aspect ratio\n");
+	printf("  -s, --stats\t\tPeriodically print copy statistics\n");
+	printf("  -b, --backend name\tConversion backend: auto, ge2d, cpu, scalar, sse2, avx2, neon\n");
+	printf("  -d, --depth n\t\tNumber of output buffers converted ahead of the copy (default 2)\n");
+	printf("  -i, --input spec\tSource framebuffer (default /dev/fb0)\n");
+	printf("  -o, --output spec\tLCD framebuffer (default /dev/fb2); repeat for more LCDs.\n");
+	printf("\t\t\tMay be followed by ,aspect=h:w ,fps=n ,depth=n ,backend=name ,rotate=n\n");
+	printf("  -r, --rate hz\t\tSimulated vsync rate when there is no vsync (default 60)\n");
+	printf("  -f, --fps n|auto\tLCD output rate; 0 converts every source frame (default auto)\n");
+	printf("      --rotate n|auto\tRotate the image 0, 90, 180 or 270 degrees clockwise in the\n");
+	printf("\t\t\tconversion; auto turns a portrait LCD to landscape (default auto)\n");
+	printf("      --flip h|v\t\tMirror the image horizontally and/or vertically\n");
+	printf("      --ge2d-rotate\tLet GE2D rotate and flip (not yet verified on hardware;\n");
+	printf("\t\t\totherwise a rotated or flipped image is converted by the CPU)\n");
+	printf("      --overlay[=fb]\tBlend the ARGB OSD1 framebuffer over the source (default /dev/fb1)\n");
+	printf("      --ion-cache mode\tGE2D output mapping: default, cached (aarch64), wc, uncached\n");
+	printf("      --roi x,y,w,h\tMirror only this rectangle of the source\n");
+	printf("      --zoom z\t\tMirror the center of the source magnified z times\n");
+	printf("      --control path\tAccept roi/move/pan/center/zoom/reset commands on a datagram socket\n");
+	printf("      --metrics path\tServe Prometheus metrics over HTTP on a Unix stream socket\n");
+	printf("      --trace file\tRecord a frame timeline; written as Chrome trace JSON on USR2 and exit\n");
+	printf("      --follow-mouse[=dev]\tMove the region with the mouse (default /dev/input/mice)\n");
+	printf("      --autotune\t\tPick backend, ION cache mode and copy kernel by measuring once\n");
+	printf("      --retune\t\tMeasure again even if the profile has an entry\n");
+	printf("      --profile path\tAutotune profile (default /var/cache/c2screen2lcd/profile)\n");
+	printf("      --copy name\t\tLCD copy kernel: auto, memcpy, neon, stream (default auto)\n");
+	printf("      --no-zero-copy\tAlways convert into an ION buffer and copy to the LCD\n");
+	printf("      --no-idle\t\tKeep converting while the source is static\n");
+	printf("      --dim duty\t\tBacklight pwm duty while idle (default: no dimming)\n");
+	printf("      --dim-after s\tSeconds idle before dimming (default 30)\n");
+	printf("      --realtime[=cpu]\tPin the loop (default: last core), lock and pre-fault memory\n");
+	printf("      --rt-priority n\tAlso run it SCHED_FIFO at priority n (1-99); implies --realtime\n");
+	printf("      --threaded\t\tCapture, convert and present on separate threads\n");
+	printf("      --cpus list\tCPUs for those threads: auto, none or c,c,c (default auto)\n");
+	printf("      --bench n\t\tRun n frames against synthetic buffers, print timings and exit\n");
+	printf("      --probe n\t\tDraw n time-coded markers into the source, report their age on the sinks and exit\n");
+	printf("      --bench-convert n\tTime n 1920x1080 to 480x320 CPU conversions and exit\n");
+	printf("      --bench-copy n\tTime n copies with each kernel (into --output if given) and exit\n");
+	printf("      --bench-readback n\tTime n reads of an ION buffer in each cache mode and exit\n");
+
+	printf("\nFramebuffer specs: /dev/fbN, file:PATH@WxHxBPP, shm:NAME@WxHxBPP,\n");
+	printf("memfd:NAME@WxHxBPP, raw:PATH@WxHxBPP (PATH may be a printf pattern)\n");
+
+	printf("\nSignals: TERM and INT stop and leave the LCDs black, HUP re-reads the\n");
+	printf("fb0 mode, USR1 prints statistics, USR2 writes the --trace file\n");
 }
 
 
 int main(int argc, char** argv)
 {
-	int io;
+	// Keep the log readable when redirected to a file or journal
+	setvbuf(stdout, NULL, _IOLBF, 0);
 
 
 	// options
 	int c;
-	float aspect = -1;
-
-	while ((c = getopt_long(argc, argv, "a:", longopts, NULL)) != -1)
+	MirrorOptions options;
+	bool stats = false;
+	const char* input = nullptr;
+	std::vector<const char*> outputs;
+	double rate = -1;
+	int benchFrames = 0;
+	int probeFrames = 0;
+	int benchCopy = 0;
+	double zoom = 1;
+	const char* controlPath = nullptr;
+	const char* metricsPath = nullptr;
+	const char* tracePath = nullptr;
+	const char* mouseDevice = nullptr;
+	int dimDuty = -1;
+	double dimAfter = 30;
+	bool realtime = false;
+	int realtimeCpu = -1;
+	int realtimePriority = 0;
+
+	while ((c = getopt_long(argc, argv, "a:sb:d:i:o:r:f:", longopts, NULL)) != -1)
 	{
 		switch (c)
 		{
 			case 'a':
-			{
-				if (strchr(optarg, ':'))
+				options.Aspect = ParseAspect(optarg);
+				break;
+
+			case 's':
+				stats = true;
+				break;
+
+			case 'b':
+				options.Backend = optarg;
+				break;
+
+			case 'd':
+				options.Depth = atoi(optarg);
+				if (options.Depth < 1)
 				{
-					unsigned int h;
-					unsigned int w;
-					double s;
-					if (sscanf(optarg, "%u:%u", &h, &w) == 2)
-					{
-						aspect = (float)h / (float)w;
-					}
-					else
-					{
-						throw Exception("invalid aspect");
-					}
+					throw Exception("invalid depth");
 				}
-				else
+				break;
+
+			case 'i':
+				input = optarg;
+				break;
+
+			case 'o':
+				outputs.push_back(optarg);
+				break;
+
+			case 'r':
+				rate = atof(optarg);
+				break;
+
+			case 'f':
+				options.OutputRate = (strcmp(optarg, "auto") == 0) ? -1 : atof(optarg);
+				break;
+
+			case 'Z':
+				options.ZeroCopy = false;
+				break;
+
+			case 'I':
+				options.Idle = false;
+				break;
+
+			case 'D':
+				dimDuty = atoi(optarg);
+				break;
+
+			case 'A':
+				dimAfter = atof(optarg);
+				break;
+
+			case 'T':
+				options.Threaded = true;
+				break;
+
+			case 'c':
+				options.Cpus = optarg;
+				break;
+
+			case 'O':
+				options.Rotation = ParseRotation(optarg);
+				break;
+
+			case 'F':
+				ParseFlip(optarg, options);
+				break;
+
+			case 'G':
+				options.Ge2dRotate = true;
+				break;
+
+			case 'B':
+				benchFrames = atoi(optarg);
+				break;
+
+			case 'C':
+				RunConvertBenchmark(atoi(optarg));
+				exit(EXIT_SUCCESS);
+
+			case 'R':
+				RunReadbackBenchmark(atoi(optarg));
+				exit(EXIT_SUCCESS);
+
+			case 'x':
+				options.SourceRect = Viewport::ParseRect(optarg);
+				if (options.SourceRect.Width < 1 || options.SourceRect.Height < 1)
 				{
-					aspect = atof(optarg);
+					throw Exception("invalid roi");
 				}
-			}
-			break;
+				break;
+
+			case 'z':
+				zoom = atof(optarg);
+				break;
+
+			case 'E':
+				metricsPath = optarg;
+				break;
+
+			case 'Y':
+				tracePath = optarg;
+				break;
+
+			case 'Q':
+				probeFrames = atoi(optarg);
+				break;
+
+			case 'V':
+				options.Overlay = optarg ? optarg : "/dev/fb1";
+				break;
+
+			case 'X':
+				realtime = true;
+				realtimeCpu = optarg ? atoi(optarg) : -1;
+				break;
+
+			case 'W':
+				realtimePriority = atoi(optarg);
+				if (realtimePriority < 0 || realtimePriority > 99)
+				{
+					throw Exception("invalid rt-priority");
+				}
+				realtime = true;
+				break;
+
+			case 'L':
+				controlPath = optarg;
+				break;
+
+			case 'm':
+				mouseDevice = optarg ? optarg : "/dev/input/mice";
+				break;
+
+			case 't':
+				if (options.Autotune == AutotuneMode::Off)
+					options.Autotune = AutotuneMode::Profile;
+				break;
+
+			case 'U':
+				options.Autotune = AutotuneMode::Force;
+				break;
+
+			case 'p':
+				options.Profile = optarg;
+				break;
+
+			case 'k':
+				options.Copy = optarg;
+				break;
+
+			case 'K':
+				benchCopy = atoi(optarg);
+				break;
+
+			case 'M':
+				options.IonCache = optarg;
+				break;
 
 			default:
 				ShowUsage();
@@ -75,168 +410,261 @@ int main(int argc, char** argv)
 	}
 
 
-	// HDMI (ARGB32)
-	FrameBuffer fb0("/dev/fb0");
-	printf("fb0: screen info - width=%d, height=%d, bpp=%d\n", fb0.Width(), fb0.Height(), fb0.BitsPerPixel());
-
+	if (benchCopy > 0)
+	{
+		RunCopyBenchmark(benchCopy, outputs.empty() ? nullptr : outputs[0]);
+		return 0;
+	}
 
-	// LCD (RGB565)
-	FrameBuffer fb2("/dev/fb2");
-	printf("fb2: screen info - width=%d, height=%d, bpp=%d\n", fb2.Width(), fb2.Height(), fb2.BitsPerPixel());
 
-	if (fb2.BitsPerPixel() != 16)
+	// Options given after an output still apply to it
+	std::vector<SinkConfig> sinks;
+	for (const char* output : outputs)
 	{
-		throw Exception("Unexpected fb2 bits per pixel");
+		sinks.push_back(ParseSink(output, options));
 	}
 
+	if (benchFrames > 0)
+	{
+		// Synthetic buffers and no vsync pacing unless asked for
+		if (sinks.empty())
+			sinks.push_back(ParseSink("memfd:bench-fb2@480x320x16", options));
+
+		RunBenchmark(benchFrames,
+			input ? input : "memfd:bench-fb0@1920x1080x32",
+			sinks,
+			rate < 0 ? 0 : rate);
+
+		return 0;
+	}
 
-	// GE2D
-	int ge2d_fd = open("/dev/ge2d", O_RDWR);
-	if (ge2d_fd < 0)
+	if (probeFrames > 0)
 	{
-		throw Exception("open /dev/ge2d failed.");
+		// Stand-ins unless a source is given; the markers overwrite a
+		// corner of it
+		if (sinks.empty())
+			sinks.push_back(ParseSink(input ? "/dev/fb2" : "memfd:probe-fb2@480x320x16", options));
+
+		RunLatencyProbe(probeFrames,
+			input ? input : "memfd:probe-fb0@1920x1080x32",
+			sinks,
+			rate < 0 ? 60 : rate);
+
+		return 0;
 	}
 
+	if (sinks.empty())
+	{
+		sinks.push_back(ParseSink("/dev/fb2", options));
+	}
 
-	// Ion
-	IonBuffer lcdBuffer(fb2.Length());
-	void* lcdBufferPtr = lcdBuffer.Map();
 
+	// HDMI (ARGB32)
+	FrameBuffer* source = FrameBuffer::Create(input ? input : "/dev/fb0", rate < 0 ? 60 : rate);
+	printf("fb0: screen info - width=%d, height=%d, bpp=%d\n", source->Width(), source->Height(), source->BitsPerPixel());
 
-	// Clear the LCD display
-	uint16_t* fb2mem = (uint16_t*)fb2.Data();
+	Viewport viewport(source->Width(), source->Height());
 
-	for (int y = 0; y < fb2.Height(); ++y)
+	if (options.SourceRect.Width > 0)
 	{
-		for (int x = 0; x < fb2.Width(); ++x)
-		{
-			size_t offset = y * fb2.Width() + x;
+		viewport.Select(options.SourceRect);
+	}
 
-			// 16 bit color
-			//fb2mem[offset] = 0xf800;	// Red
-			//fb2mem[offset] = 0x07e0;	// Green
-			//fb2mem[offset] = 0x001f;	// Blue
-			fb2mem[offset] = 0xffff;	// White
-		}
+	if (zoom > 1)
+	{
+		viewport.Zoom(zoom);
 	}
 
+	for (SinkConfig& config : sinks)
+	{
+		config.Options.SourceRect = viewport.Rect();
+	}
 
-	// Configure GE2D
-	struct config_para_ex_s configex = { 0 };
+	if (controlPath)
+	{
+		viewport.OpenControlSocket(controlPath);
+	}
 
-	switch (fb0.BitsPerPixel())
+	if (mouseDevice)
 	{
-		case 16:
-			configex.src_para.format = GE2D_FORMAT_S16_RGB_565;
-			break;
+		viewport.FollowMouse(mouseDevice);
+	}
 
-		case 24:
-			configex.src_para.format = GE2D_FORMAT_S24_RGB;
-			break;
 
-		case 32:
-			configex.src_para.format = GE2D_FORMAT_S32_ARGB;
-			break;
+	MirrorGroup* group = new MirrorGroup(*source);
+	group->SetDim(dimDuty, dimAfter);
+	std::vector<FrameBuffer*> lcds;
 
-		default:
-			throw Exception("fb0 bits per pixel not supported");
-	}
+	auto updateViewport = [&]()
+	{
+		if (viewport.Poll())
+		{
+			group->SetSourceRect(viewport.Rect());
+		}
+	};
 
-	configex.src_para.mem_type = CANVAS_OSD0;
-	configex.src_para.left = 0;
-	configex.src_para.top = 0;
-	configex.src_para.width = fb0.Width();
-	configex.src_para.height = fb0.Height();
 
-	configex.src2_para.mem_type = CANVAS_TYPE_INVALID;
+	// Signals are blocked before the pipeline threads start so that only
+	// the loop sees them.
+	EventLoop loop;
 
-	configex.dst_para.mem_type = CANVAS_ALLOC;
-	configex.dst_para.format = GE2D_FORMAT_S16_RGB_565;
-	configex.dst_para.left = 0;
-	configex.dst_para.top = 0;
-	configex.dst_para.width = fb2.Width();
-	configex.dst_para.height = fb2.Height();
-	configex.dst_planes[0].addr = lcdBuffer.PhysicalAddress();
-	configex.dst_planes[0].w = fb2.Width();
-	configex.dst_planes[0].h = fb2.Height();
+	loop.OnSignal(SIGINT, [&]() { loop.Stop(); });
+	loop.OnSignal(SIGTERM, [&]() { loop.Stop(); });
+	loop.OnSignal(SIGUSR1, [&]() { group->PrintStats(); });
 
-	io = ioctl(ge2d_fd, GE2D_CONFIG_EX, &configex);
-	if (io < 0)
+	if (tracePath)
 	{
-		throw Exception("GE2D_CONFIG_EX failed.\n");
+		Tracer::Instance().Enable();
+		loop.OnSignal(SIGUSR2, [&]() { Tracer::Instance().Write(tracePath); });
 	}
 
+	bool remapped = false;
+
+	loop.OnSignal(SIGHUP, [&]()
+	{
+		group->Reconfigure();
+		viewport.SetSourceSize(source->Width(), source->Height());
+		updateViewport();
+		remapped = true;
+	});
 
-	// Aspect ratio
-	const float LCD_ASPECT = 1.5f;	// LCD aspect = 3:2 = 1.5
 
-	// If no aspect ratio was specified, calculate it
-	if (aspect == -1)
+	// Set before the mirrors start their threads, which inherit it
+	if (realtimePriority > 0)
 	{
-		aspect = (float)fb0.Width() / (float)fb0.Height();
+		Realtime::SetFifo(realtimePriority);
 	}
 
-	int dstX;
-	int dstY;
-	int dstWidth;
-	int dstHeight;
 
-	if (aspect == LCD_ASPECT)
+	for (SinkConfig& config : sinks)
 	{
-		dstWidth = fb2.Width();
-		dstHeight = fb2.Height();
-		dstX = 0;
-		dstY = 0;
+		// LCD (RGB565)
+		FrameBuffer* sink = FrameBuffer::Create(config.Spec.c_str(), rate < 0 ? 60 : rate);
+		printf("%s: screen info - width=%d, height=%d, bpp=%d\n", config.Spec.c_str(),
+			sink->Width(), sink->Height(), sink->BitsPerPixel());
+
+		lcds.push_back(sink);
+
+		AutoTuner::Apply(*source, *sink, config.Options);
+
+		group->Add(new Mirror(*source, *sink, config.Options));
 	}
-	else if (aspect < LCD_ASPECT)
+
+
+	// Every mapping the frames touch is resident before the first one
+	auto prefault = [&]()
 	{
-		dstWidth = fb2.Height() * aspect;
-		dstHeight = fb2.Height();
-		dstX = (fb2.Width() / 2) - (dstWidth / 2);
-		dstY = 0;
-	}
-	else
+		Realtime::Prefault(source->Data(), source->Length());
+
+		for (const Mirror* mirror : group->Mirrors())
+		{
+			Realtime::Prefault(mirror->Sink().Data(), mirror->Sink().Length());
+
+			if (mirror->Overlay())
+				Realtime::Prefault(mirror->Overlay()->Data(), mirror->Overlay()->Length());
+
+			const Converter& converter = mirror->GetConverter();
+			for (int i = 0; i < converter.BufferCount(); ++i)
+			{
+				Realtime::Prefault(converter.Output(i), converter.OutputLength());
+			}
+		}
+
+		Realtime::LockMemory();
+	};
+
+	if (realtime)
 	{
-		dstWidth = fb2.Width();
-		dstHeight = fb2.Width() * (1.0f / aspect);
-		dstX = 0;
-		dstY = (fb2.Height() / 2) - (dstHeight / 2);
+		// The threaded pipeline pins its own threads with --cpus
+		if (realtimeCpu < 0 && !options.Threaded)
+			realtimeCpu = Realtime::DefaultCpu();
+
+		if (realtimeCpu >= 0)
+			Realtime::Pin(realtimeCpu);
+
+		prefault();
 	}
 
-	printf("aspect=%f\n", aspect);
 
+	if (viewport.ControlFd() >= 0)
+	{
+		loop.Watch(viewport.ControlFd(), updateViewport);
+	}
 
-	//  Blit rectangle
-	ge2d_para_s blitRect = { 0 };
+	if (viewport.MouseFd() >= 0)
+	{
+		loop.Watch(viewport.MouseFd(), updateViewport);
+	}
 
-	blitRect.src1_rect.x = 0;
-	blitRect.src1_rect.y = 0;
-	blitRect.src1_rect.w = fb0.Width();
-	blitRect.src1_rect.h = fb0.Height();
+	MetricsServer* metrics = nullptr;
+	if (metricsPath)
+	{
+		metrics = new MetricsServer(*group, metricsPath);
+		loop.Watch(metrics->Fd(), [&]() { metrics->Accept(); });
+	}
 
-	blitRect.dst_rect.x = dstX;
-	blitRect.dst_rect.y = dstY;
-	blitRect.dst_rect.w = dstWidth;
-	blitRect.dst_rect.h = dstHeight;
 
+	// The loop sleeps until shortly before the next vsync; RunFrame then
+	// waits for the vsync itself.
+	const int STATS_INTERVAL = 300;
+	int frameTimer = -1;
 
-	while (true)
+	frameTimer = loop.AddTimer([&]()
 	{
-		// Wait for VSync
-		fb0.WaitForVSync();
+		if (group->CheckMode())
+		{
+			viewport.SetSourceSize(source->Width(), source->Height());
+			updateViewport();
+			remapped = true;
+		}
 
-		// Color conversion
-		io = ioctl(ge2d_fd, GE2D_STRETCHBLIT_NOALPHA, &blitRect);
-		if (io < 0)
+		// New mappings after a mode change
+		if (remapped && realtime)
 		{
-			throw Exception("GE2D_STRETCHBLIT_NOALPHA failed.");
+			prefault();
 		}
+		remapped = false;
 
-		// Copy to LCD
-		memcpy(fb2mem, lcdBufferPtr, lcdBuffer.BufferSize());
+		group->RunFrame();
+
+		if (stats && (group->Frames() % STATS_INTERVAL) == 0)
+		{
+			group->PrintStats();
+		}
+
+		loop.ArmTimer(frameTimer, group->NextFrameTime());
+	});
+
+	loop.ArmTimer(frameTimer, 0);
+	loop.Run();
+
+	printf("stopping\n");
+
+
+	// Leave the LCDs black rather than showing the last frame
+	group->Blank();
+
+	if (stats)
+	{
+		group->PrintStats();
+	}
+
+	if (tracePath)
+	{
+		Tracer::Instance().Write(tracePath);
 	}
 
 
 	// Terminate
+	delete metrics;
+	delete group;
+
+	for (FrameBuffer* sink : lcds)
+	{
+		delete sink;
+	}
+
+	delete source;
+
 	return 0;
 }